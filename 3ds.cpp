@@ -1,254 +1,1310 @@
 #include "3ds.h"
+#include "mapping3ds.h"
+#include "bake3ds.h"
+#include "anim3ds.h"
+#include "ray3ds.h"
 
-Object::Object(GLuint *&tex, GLuint sel):
+Object::Object(GLuint sel):
 	name(NULL),
+	nameId(noStringId),
 	vertices(NULL),
 	normals(NULL),
 	faces(NULL),
 	mapCoords(NULL),
+	smoothingGroups(NULL),
 	numVertices(0),
 	numFaces(0),
+	numMapCoords(0),
+	firstVertexList(0),
+	numVertexLists(0),
+	vertexOffset(0),
+	normalOffset(0),
+	mapCoordOffset(0),
+	indexOffset(0),
+	rottrackAngle(0.f),
+	scaletrackX(1.f),
+	scaletrackY(1.f),
+	scaletrackZ(1.f),
+	parent(noIndex),
+	firstChild(0),
+	numChildren(0),
 	selectName(sel),
 	selected(false)
-{
-	textures = &tex;
-}
-
-Object::~Object()
-{
-	delete [] name;
-	delete [] vertices;
-	delete [] normals;
-	delete [] faces;
-	delete [] mapCoords;
-		
-	for_each(vertexLists.begin(), vertexLists.end(), deleteElement<VertexList>);
-}
+{}
 
 Model3DS::Model3DS(GLuint sel):
 	path(NULL),
-	rootLevel(-1),
-	previousObject(NULL),
+	strings(arena),
+	stream(NULL),
+	truncated(false),
+	textureDecoding(true),
+	soaLayout(false),
+	bvhEnabled(false),
+	bufferObjects(false),
+	normalMode(areaWeightedNormals),
+	smoothing(true),
+	normalThreads(cfg3ds::normalThreads),
+	numFinishedObjects(0),
+	stats(NULL),
+	firstFrame(0),
+	lastFrame(0),
+	sampler(NULL),
+	transformsDirty(true),
+	culling(true),
 	textures(NULL),
+	numTextures(0),
+	vertexBuffer(0),
+	indexBuffer(0),
+	bakedFile(NULL),
 	selectName(sel),
 	currentSelectName(0),
-	selectedObject(NULL)
+	selectedObject(noIndex)
 {}
 
 Model3DS::~Model3DS()
 {
-	for_each(objects.begin(), objects.end(), deleteElement<Object>);
-	for_each(materials.begin(), materials.end(), deleteElement<Material>);
-	glDeleteTextures(numTextures, textures);
+	for (size_t i=0; i<sharedTextures.size(); ++i)
+		TextureRegistry::instance().release(sharedTextures[i]);
 	delete [] path;
+	delete stats;
 	delete [] textures;
+	delete bakedFile;
+	delete sampler;
+	
+	if (vertexBuffer != 0) {
+		GLuint buffers[] = {vertexBuffer, indexBuffer};
+		buffers3ds::deleteBuffers(2, buffers);
+	}
+}
+
+bool Model3DS::parse(const char *fileName)
+{
+	MappedFile file;
+	
+	if (!file.open(fileName))
+		return false;
+	
+	LOG3DS_DEBUG("loading " << fileName);
+	setPathOf(fileName);
+	
+	// the mesh data takes about as much memory as the file
+	arena.reserve(file.size());
+	
+	MemoryStream3DS source(file.data(), file.size());
+	return parseFrom(source);
+}
+
+bool Model3DS::parse(const void *data, size_t size, const char *texturePath)
+{
+	if (data == NULL)
+		return false;
+	
+	setPath(texturePath, strlen(texturePath));
+	arena.reserve(size);
+	
+	MemoryStream3DS source(data, size);
+	return parseFrom(source);
+}
+
+bool Model3DS::parse(Stream3DS &source, const char *texturePath)
+{
+	setPath(texturePath, strlen(texturePath));
+	
+	return parseFrom(source);
+}
+
+bool Model3DS::parseFrom(Stream3DS &source)
+{
+	PROFILE3DS_SCOPE(stats, LoadStats::parse, 0);
+	
+	stream = &source;
+	truncated = false;
+	bool result = parseRoot();
+	stream = NULL;
+	
+	// the poses and the sampler only cover the objects of the last
+	// animate(), so the model is static again until the next one
+	if (!poses.empty() && poses.size() != objects.size()) {
+		delete sampler;
+		sampler = NULL;
+		poses.clear();
+		invalidateTransforms();
+	}
+	
+	if (result) {
+		finishMeshes();
+		if (bvhEnabled)
+			buildBVHs();
+	}
+	
+	return result;
 }
 
 bool Model3DS::load(const char *fileName)
 {
-	path = NULL;
-	char *file = strrchr(const_cast<char *>(fileName), '/');
-	if (file == NULL)
-		file = strrchr(const_cast<char *>(fileName), '\\');
-	if (file == NULL) {
-		file = const_cast<char *>(fileName);
-		path = const_cast<char *>("");
+	if (!parse(fileName))
+		return false;
+	
+	upload();
+	return true;
+}
+
+bool Model3DS::load(const void *data, size_t size, const char *texturePath)
+{
+	if (!parse(data, size, texturePath))
+		return false;
+	
+	upload();
+	return true;
+}
+
+bool Model3DS::load(Stream3DS &source, const char *texturePath)
+{
+	if (!parse(source, texturePath))
+		return false;
+	
+	upload();
+	return true;
+}
+
+bool Model3DS::bake(const char *fileName)
+{
+	if (compiledMeshes.size() != objects.size())
+		compile();
+	
+	vector<Byte> data;
+	bake3ds::Writer out(data);
+	out.reserve<bake3ds::Header>(1);
+	
+	bake3ds::Header header;
+	memcpy(header.magic, bake3ds::magic, sizeof(header.magic));
+	header.version = bake3ds::version;
+	header.byteOrder = bake3ds::byteOrder;
+	
+	vector<bake3ds::Object> bakedObjects(objects.size());
+	for (size_t i=0; i<objects.size(); ++i) {
+		const Object &object = objects[i];
+		bake3ds::Object &baked = bakedObjects[i];
+		
+		baked.name = out.addString(object.name);
+		baked.vertices = out.add(object.vertices, sizeof(Vertex)*object.numVertices);
+		baked.normals = (object.normals != NULL ? out.add(object.normals, sizeof(Vector)*object.numVertices) : bake3ds::none);
+		baked.faces = out.add(object.faces, sizeof(Face)*object.numFaces);
+		baked.mapCoords = (object.mapCoords != NULL ? out.add(object.mapCoords, sizeof(MapCoord)*object.numMapCoords) : bake3ds::none);
+		baked.numVertices = object.numVertices;
+		baked.numFaces = object.numFaces;
+		baked.numMapCoords = (object.mapCoords != NULL ? object.numMapCoords : 0);
+		baked.padding = 0;
+		baked.firstVertexList = object.firstVertexList;
+		baked.numVertexLists = object.numVertexLists;
+		
+		baked.u = object.u;
+		baked.v = object.v;
+		baked.w = object.w;
+		baked.origin = object.origin;
+		baked.pivot = object.pivot;
+		baked.postrack = object.postrack;
+		baked.rottrackAxis = object.rottrackAxis;
+		baked.rottrackAngle = object.rottrackAngle;
+		baked.scaletrackX = object.scaletrackX;
+		baked.scaletrackY = object.scaletrackY;
+		baked.scaletrackZ = object.scaletrackZ;
+		baked.positionTrack = object.positionTrack;
+		baked.rotationTrack = object.rotationTrack;
+		baked.scaleTrack = object.scaleTrack;
+		baked.position = object.position;
+		baked.rotation = object.rotation;
+		baked.bounds = object.bounds;
+		
+		baked.parent = object.parent;
+		baked.firstChild = object.firstChild;
+		baked.numChildren = object.numChildren;
 	}
 	
-	cout << file << endl;
+	vector<bake3ds::Material> bakedMaterials(materials.size());
+	for (size_t i=0; i<materials.size(); ++i) {
+		bakedMaterials[i].name = out.addString(materials[i].name);
+		bakedMaterials[i].texmapFile = out.addString(materials[i].texmapFile);
+		bakedMaterials[i].ambient = materials[i].ambient;
+		bakedMaterials[i].diffuse = materials[i].diffuse;
+		bakedMaterials[i].specular = materials[i].specular;
+	}
+	
+	vector<bake3ds::VertexList> bakedVertexLists(vertexLists.size());
+	for (size_t i=0; i<vertexLists.size(); ++i) {
+		bakedVertexLists[i].material = vertexLists[i].material;
+		bakedVertexLists[i].verticesRefs = out.add(vertexLists[i].verticesRefs, sizeof(Word)*vertexLists[i].numVerticesRefs);
+		bakedVertexLists[i].numVerticesRefs = vertexLists[i].numVerticesRefs;
+	}
 	
-	if (path == NULL) {
-		path = new char[strlen(fileName)-strlen(file)+2];
+	vector<bake3ds::Mesh> bakedMeshes(compiledMeshes.size());
+	for (size_t i=0; i<compiledMeshes.size(); ++i) {
+		const CompiledMesh &mesh = compiledMeshes[i];
+		bake3ds::Mesh &baked = bakedMeshes[i];
 		
-		strncpy(path, fileName, strlen(fileName)-strlen(file)+1);
-		path[strlen(fileName)-strlen(file)+1] = '\0';
+		baked.vertices = out.add(mesh.vertices.empty() ? NULL : &mesh.vertices[0], sizeof(CompiledVertex)*mesh.vertices.size());
+		baked.numVertices = mesh.vertices.size();
+		baked.indices = out.add(mesh.getIndexData(), mesh.getIndexSize()*mesh.getNumIndices());
+		baked.numIndices = mesh.getNumIndices();
+		baked.indexSize = mesh.getIndexSize();
+		baked.ranges = out.add(mesh.ranges.empty() ? NULL : &mesh.ranges[0], sizeof(CompiledMesh::Range)*mesh.ranges.size());
+		baked.numRanges = mesh.ranges.size();
+		baked.hasNormals = mesh.hasNormals;
+		baked.hasMapCoords = mesh.hasMapCoords;
 	}
 	
-	cout << path << endl;
-
-	fp = fopen(fileName, "rb");
+	header.numObjects = objects.size();
+	header.objects = out.add(bakedObjects.empty() ? NULL : &bakedObjects[0], sizeof(bake3ds::Object)*bakedObjects.size());
+	header.numMaterials = materials.size();
+	header.materials = out.add(bakedMaterials.empty() ? NULL : &bakedMaterials[0], sizeof(bake3ds::Material)*bakedMaterials.size());
+	header.numVertexLists = vertexLists.size();
+	header.vertexLists = out.add(bakedVertexLists.empty() ? NULL : &bakedVertexLists[0], sizeof(bake3ds::VertexList)*bakedVertexLists.size());
+	header.numRoots = roots.size();
+	header.roots = out.add(roots.empty() ? NULL : &roots[0], sizeof(DWord)*roots.size());
+	header.numChildren = children.size();
+	header.children = out.add(children.empty() ? NULL : &children[0], sizeof(DWord)*children.size());
+	header.meshes = out.add(bakedMeshes.empty() ? NULL : &bakedMeshes[0], sizeof(bake3ds::Mesh)*bakedMeshes.size());
+	header.numPositionKeys = positionKeys.size();
+	header.positionKeys = out.add(positionKeys.empty() ? NULL : &positionKeys[0], sizeof(VectorKey)*positionKeys.size());
+	header.numRotationKeys = rotationKeys.size();
+	header.rotationKeys = out.add(rotationKeys.empty() ? NULL : &rotationKeys[0], sizeof(RotationKey)*rotationKeys.size());
+	header.numScaleKeys = scaleKeys.size();
+	header.scaleKeys = out.add(scaleKeys.empty() ? NULL : &scaleKeys[0], sizeof(VectorKey)*scaleKeys.size());
+	header.firstFrame = firstFrame;
+	header.lastFrame = lastFrame;
+	
+	if (data.size() > 0xFFFFFFFF) {
+		LOG3DS_ERROR("Model too large to bake");
+		return false;
+	}
+	
+	header.size = data.size();
+	*out.at<bake3ds::Header>(0) = header;
 	
+	FILE *fp = fopen(fileName, "wb");
 	if (fp == NULL)
 		return false;
 	
-	parse();
+	bool written = fwrite(&data[0], 1, data.size(), fp) == data.size();
+	written = fclose(fp) == 0 && written;
+	
+	// a partial file must not pass for a cache
+	if (!written)
+		remove(fileName);
 	
-	fclose(fp);
+	return written;
+}
+
+bool Model3DS::parseBaked(const char *fileName)
+{
+	setPathOf(fileName);
+	
+	return readBaked(fileName);
+}
+
+bool Model3DS::parseCached(const char *fileName, const char *bakedFileName)
+{
+	setPathOf(fileName);
+	
+	if (bake3ds::isNewer(bakedFileName, fileName)) {
+		try {
+			if (readBaked(bakedFileName))
+				return true;
+		} catch (exception &e) {
+			LOG3DS_WARNING(bakedFileName << ": " << e.what() << ", parsing the model again");
+		}
+	}
+	
+	if (!parse(fileName))
+		return false;
+	
+	if (!bake(bakedFileName))
+		LOG3DS_WARNING("Can't write " << bakedFileName);
 	
 	return true;
 }
 
-void Object::draw(bool highlighted) const
+bool Model3DS::readBaked(const char *fileName)
 {
-	glPushName(selectName);
+	if (!objects.empty() || !materials.empty()) {
+		LOG3DS_WARNING("A baked model can only be read into an empty model");
+		return false;
+	}
 	
-	glPushMatrix();
+	MappedFile *file = new MappedFile();
+	if (!file->open(fileName)) {
+		delete file;
+		return false;
+	}
+	
+	// stale or foreign files are simply not used
+	const bake3ds::Header *header = static_cast<const bake3ds::Header *>(file->data());
+	if (file->size() < sizeof(bake3ds::Header)
+		|| memcmp(header->magic, bake3ds::magic, sizeof(header->magic)) != 0
+		|| header->version != bake3ds::version
+		|| header->byteOrder != bake3ds::byteOrder
+		|| header->size != file->size()) {
+		LOG3DS_INFO(fileName << " isn't a baked model of this version");
+		delete file;
+		return false;
+	}
+	
+	try {
+		readBaked(file->data(), file->size());
+	} catch (...) {
+		delete file;
+		throw;
+	}
+	
+	delete bakedFile;
+	bakedFile = file;
+	
+	return true;
+}
 
-	if (numVertices != 0) {	
-		GLfloat m[] = {
-			u.x, u.y, u.z, 0.f,
-			v.x, v.y, v.z, 0.f,
-			w.x, w.y, w.z, 0.f,
-			0,0,0, 1.f
-		};
+namespace
+{
+	// in range and in increasing frame order, which the sampler relies on
+	template <typename Key>
+	bool isTrackValid(const Track &track, const Key *keys, DWord numKeys)
+	{
+		if (track.firstKey > numKeys || track.numKeys > numKeys - track.firstKey)
+			return false;
+		
+		for (DWord i=1; i<track.numKeys; ++i) {
+			if (!(keys[track.firstKey + i-1].frame < keys[track.firstKey + i].frame))
+				return false;
+		}
+		return true;
+	}
+}
 
-		GLfloat mInv[] = {
-			u.x, v.x, w.x, 0.f,
-			u.y, v.y, w.y, 0.f,
-			u.z, v.z, w.z, 0.f,
-			0.f, 0.f, 0.f, 1.f
-		};
+void Model3DS::readBaked(const void *data, size_t size)
+{
+	PROFILE3DS_SCOPE(stats, LoadStats::parse, size);
+	
+	bake3ds::Reader in(data, size);
+	const bake3ds::Header &header = *in.get<bake3ds::Header>(0, 1);
+	
+	const bake3ds::Object *bakedObjects = in.get<bake3ds::Object>(header.objects, header.numObjects);
+	const bake3ds::Material *bakedMaterials = in.get<bake3ds::Material>(header.materials, header.numMaterials);
+	const bake3ds::VertexList *bakedVertexLists = in.get<bake3ds::VertexList>(header.vertexLists, header.numVertexLists);
+	const DWord *bakedRoots = in.get<DWord>(header.roots, header.numRoots);
+	const DWord *bakedChildren = in.get<DWord>(header.children, header.numChildren);
+	const bake3ds::Mesh *bakedMeshes = in.get<bake3ds::Mesh>(header.meshes, header.numObjects);
+	const VectorKey *bakedPositionKeys = in.get<VectorKey>(header.positionKeys, header.numPositionKeys);
+	const RotationKey *bakedRotationKeys = in.get<RotationKey>(header.rotationKeys, header.numRotationKeys);
+	const VectorKey *bakedScaleKeys = in.get<VectorKey>(header.scaleKeys, header.numScaleKeys);
+	
+	// everything is checked before the model is changed, the arrays are
+	// used in place and the tables copied
+	vector<Material> newMaterials(header.numMaterials);
+	for (DWord i=0; i<header.numMaterials; ++i) {
+		const bake3ds::Material &baked = bakedMaterials[i];
+		Material &material = newMaterials[i];
+		
+		material.name = in.getString(baked.name);
+		material.texmapFile = in.getString(baked.texmapFile);
+		material.ambient = baked.ambient;
+		material.diffuse = baked.diffuse;
+		material.specular = baked.specular;
+	}
+	
+	vector<VertexList> newVertexLists(header.numVertexLists);
+	for (DWord i=0; i<header.numVertexLists; ++i) {
+		const bake3ds::VertexList &baked = bakedVertexLists[i];
+		
+		if (baked.material >= header.numMaterials)
+			throw runtime_error("Baked vertex list refers to a material that doesn't exist!");
+		
+		newVertexLists[i].material = baked.material;
+		newVertexLists[i].verticesRefs = const_cast<Word *>(in.get<Word>(baked.verticesRefs, baked.numVerticesRefs));
+		newVertexLists[i].numVerticesRefs = baked.numVerticesRefs;
+	}
+	
+	vector<Object> newObjects(header.numObjects);
+	for (DWord i=0; i<header.numObjects; ++i) {
+		const bake3ds::Object &baked = bakedObjects[i];
+		Object &object = newObjects[i];
+		
+		object.name = in.getString(baked.name);
+		object.vertices = const_cast<Vertex *>(in.get<Vertex>(baked.vertices, baked.numVertices));
+		object.normals = const_cast<Vector *>(in.get<Vector>(baked.normals, baked.numVertices));
+		object.faces = const_cast<Face *>(in.get<Face>(baked.faces, baked.numFaces));
+		object.mapCoords = const_cast<MapCoord *>(in.get<MapCoord>(baked.mapCoords, baked.numMapCoords));
+		object.numVertices = baked.numVertices;
+		object.numFaces = baked.numFaces;
+		object.numMapCoords = baked.numMapCoords;
+		
+		if ((object.numVertices != 0 && object.vertices == NULL) || (object.numFaces != 0 && object.faces == NULL))
+			throw runtime_error("Baked object without its arrays!");
+		
+		for (Word j=0; j<object.numFaces; ++j) {
+			const Face &face = object.faces[j];
+			if (face.vertexA >= object.numVertices || face.vertexB >= object.numVertices || face.vertexC >= object.numVertices)
+				throw runtime_error("Baked face refers to a vertex that doesn't exist!");
+		}
+		
+		if (baked.firstVertexList > header.numVertexLists || baked.numVertexLists > header.numVertexLists - baked.firstVertexList)
+			throw runtime_error("Baked object refers to vertex lists that don't exist!");
+		
+		object.firstVertexList = baked.firstVertexList;
+		object.numVertexLists = baked.numVertexLists;
+		
+		for (DWord j=0; j<object.numVertexLists; ++j) {
+			const VertexList &vertexList = newVertexLists[object.firstVertexList + j];
+			for (DWord k=0; k<vertexList.numVerticesRefs; ++k) {
+				if (vertexList.verticesRefs[k] >= object.numVertices)
+					throw runtime_error("Baked vertex list refers to a vertex that doesn't exist!");
+			}
+		}
+		
+		object.u = baked.u;
+		object.v = baked.v;
+		object.w = baked.w;
+		object.origin = baked.origin;
+		object.pivot = baked.pivot;
+		object.postrack = baked.postrack;
+		object.rottrackAxis = baked.rottrackAxis;
+		object.rottrackAngle = baked.rottrackAngle;
+		object.scaletrackX = baked.scaletrackX;
+		object.scaletrackY = baked.scaletrackY;
+		object.scaletrackZ = baked.scaletrackZ;
+		
+		if (!isTrackValid(baked.positionTrack, bakedPositionKeys, header.numPositionKeys)
+			|| !isTrackValid(baked.rotationTrack, bakedRotationKeys, header.numRotationKeys)
+			|| !isTrackValid(baked.scaleTrack, bakedScaleKeys, header.numScaleKeys))
+			throw runtime_error("Baked object has a track that doesn't exist!");
+		
+		object.positionTrack = baked.positionTrack;
+		object.rotationTrack = baked.rotationTrack;
+		object.scaleTrack = baked.scaleTrack;
+		object.position = baked.position;
+		object.rotation = baked.rotation;
+		object.bounds = baked.bounds;
+		
+		if ((baked.parent != noIndex && baked.parent >= header.numObjects)
+			|| baked.firstChild > header.numChildren || baked.numChildren > header.numChildren - baked.firstChild)
+			throw runtime_error("Baked object refers to objects that don't exist!");
+		
+		object.parent = baked.parent;
+		object.firstChild = baked.firstChild;
+		object.numChildren = baked.numChildren;
+	}
+	
+	vector<DWord> newRoots(bakedRoots, bakedRoots + header.numRoots);
+	vector<DWord> newChildren(bakedChildren, bakedChildren + header.numChildren);
+	for (size_t i=0; i<newRoots.size(); ++i) {
+		if (newRoots[i] >= header.numObjects)
+			throw runtime_error("Baked root doesn't exist!");
+	}
+	for (size_t i=0; i<newChildren.size(); ++i) {
+		if (newChildren[i] >= header.numObjects)
+			throw runtime_error("Baked child doesn't exist!");
+	}
+	
+	vector<CompiledMesh> newMeshes(bakedMeshes != NULL ? header.numObjects : 0);
+	vector<DWord> indices;
+	for (size_t i=0; i<newMeshes.size(); ++i) {
+		const bake3ds::Mesh &baked = bakedMeshes[i];
+		CompiledMesh &mesh = newMeshes[i];
+		
+		if (baked.indexSize != sizeof(Word) && baked.indexSize != sizeof(DWord))
+			throw runtime_error("Baked mesh has an unknown index size!");
+		
+		const CompiledVertex *vertices = in.get<CompiledVertex>(baked.vertices, baked.numVertices);
+		const Byte *indexData = in.get<Byte>(baked.indices, baked.indexSize*baked.numIndices);
+		const CompiledMesh::Range *ranges = in.get<CompiledMesh::Range>(baked.ranges, baked.numRanges);
+		
+		mesh.vertices.assign(vertices, vertices + baked.numVertices);
+		mesh.ranges.assign(ranges, ranges + baked.numRanges);
+		mesh.hasNormals = baked.hasNormals != 0;
+		mesh.hasMapCoords = baked.hasMapCoords != 0;
+		
+		indices.resize(baked.numIndices);
+		for (DWord j=0; j<baked.numIndices; ++j) {
+			if (baked.indexSize == sizeof(Word))
+				indices[j] = reinterpret_cast<const Word *>(indexData)[j];
+			else
+				indices[j] = reinterpret_cast<const DWord *>(indexData)[j];
+			
+			if (indices[j] >= baked.numVertices)
+				throw runtime_error("Baked mesh refers to a vertex that doesn't exist!");
+		}
+		mesh.setIndices(indices);
+		
+		for (size_t j=0; j<mesh.ranges.size(); ++j) {
+			const CompiledMesh::Range &range = mesh.ranges[j];
+			if (range.material >= header.numMaterials || range.firstIndex > baked.numIndices || range.numIndices > baked.numIndices - range.firstIndex)
+				throw runtime_error("Baked mesh has a range that doesn't exist!");
+		}
+	}
+	
+	objects.swap(newObjects);
+	materials.swap(newMaterials);
+	positionKeys.assign(bakedPositionKeys, bakedPositionKeys + header.numPositionKeys);
+	rotationKeys.assign(bakedRotationKeys, bakedRotationKeys + header.numRotationKeys);
+	scaleKeys.assign(bakedScaleKeys, bakedScaleKeys + header.numScaleKeys);
+	firstFrame = header.firstFrame;
+	lastFrame = header.lastFrame;
+	// until animate() is called again
+	poses.clear();
+	invalidateTransforms();
+	vertexLists.swap(newVertexLists);
+	roots.swap(newRoots);
+	children.swap(newChildren);
+	compiledMeshes.swap(newMeshes);
+	
+	// the names go to the string table like parsed ones
+	for (size_t i=0; i<materials.size(); ++i) {
+		Material &material = materials[i];
+		
+		material.nameId = (material.name != NULL ? strings.intern(material.name) : noStringId);
+		material.name = (material.name != NULL ? strings.get(material.nameId) : NULL);
+		addByName(materialsByName, material.nameId, i);
+		
+		if (material.texmapFile != NULL) {
+			material.texmapFile = strings.get(strings.intern(material.texmapFile));
+			material.textureRef = addTexture(material.texmapFile);
+		}
+	}
+	
+	for (size_t i=0; i<objects.size(); ++i) {
+		Object &object = objects[i];
+		
+		object.selectName = currentSelectName++;
+		object.nameId = (object.name != NULL ? strings.intern(object.name) : noStringId);
+		object.name = (object.name != NULL ? strings.get(object.nameId) : NULL);
+		addByName(objectsByName, object.nameId, i);
 		
-		glTranslatef(position.x, position.y, position.z);
+		if (soaLayout)
+			deinterleave(object);
+	}
+	
+	numFinishedObjects = objects.size();
+	
+	bvhs.clear();
+	if (bvhEnabled)
+		buildBVHs();
+}
 
-		glTranslatef(origin.x, origin.y, origin.z);
+void Model3DS::upload()
+{
+	if (textures != NULL)
+		return;
+	
+	numTextures = textureFiles.size();
+	textures = new GLuint[numTextures];
+	
+	for (GLuint i=0; i<numTextures; ++i) {
+		PROFILE3DS_SCOPE(stats, LoadStats::textureUpload, 0);
+		
+		// materials using a texture that can't be read are drawn untextured
+		textures[i] = TextureRegistry::instance().upload(sharedTextures[i]);
+		if (textures[i] == 0)
+			LOG3DS_WARNING("Can't read texture file " << textureFiles[i]);
+		
+		// time spent on the worker thread that decoded it
+		PROFILE3DS_ADD(stats, LoadStats::textureDecode, sharedTextures[i]->job->getDecodeSeconds(), 0);
+		PROFILE3DS_ADD(stats, LoadStats::mipBuild, sharedTextures[i]->job->getMipSeconds(), 0);
+	}
+	
+	if (bufferObjects)
+		uploadBuffers();
+}
 
-		glMultMatrixf(m);
+void Model3DS::uploadBuffers()
+{
+	if (!buffers3ds::load()) {
+		LOG3DS_WARNING("Buffer objects aren't supported, meshes are drawn from client memory");
+		return;
+	}
+	
+	// every object's vertices, normals and map coords one after the other,
+	// or its compiled vertices
+	size_t vertexSize = 0, indexSize = 0;
+	for (size_t i=0; i<objects.size(); ++i) {
+		Object &object = objects[i];
 		
-		if (selected) {
-			glDisable(GL_LIGHTING);
-			glLineWidth(2.f);
-			
-			glBegin(GL_LINES);
-			
-			glColor3f(1.f, 0.f, 0.f);
-			glVertex3f(0.f, 0.f, 0.f);
-			glVertex3f(20.f, 0.f, 0.f);
-			
-			glColor3f(0.f, 1.f, 0.f);
-			glVertex3f(0.f, 0.f, 0.f);
-			glVertex3f(0.f, 20.f, 0.f);
-			
-			glColor3f(0.f, 0.f, 1.f);
-			glVertex3f(0.f, 0.f, 0.f);
-			glVertex3f(0.f, 0.f, 20.f);
+		if (i < compiledMeshes.size()) {
+			const CompiledMesh &mesh = compiledMeshes[i];
 			
-			glEnd();
+			object.vertexOffset = vertexSize;
+			vertexSize += sizeof(CompiledVertex)*mesh.vertices.size();
+			// keeps the 32 bit indices aligned
+			indexSize = (indexSize + sizeof(DWord) - 1) & ~(sizeof(DWord) - 1);
+			object.indexOffset = indexSize;
+			indexSize += mesh.getIndexSize()*mesh.getNumIndices();
+			continue;
+		}
+		
+		object.vertexOffset = vertexSize;
+		vertexSize += sizeof(Vertex)*object.numVertices;
+		object.normalOffset = vertexSize;
+		if (object.normals != NULL)
+			vertexSize += sizeof(Vector)*object.numVertices;
+		object.mapCoordOffset = vertexSize;
+		if (object.mapCoords != NULL)
+			vertexSize += sizeof(MapCoord)*object.numVertices;
+	}
+	
+	// the vertex lists only of the objects drawn without a compiled mesh
+	for (size_t i=compiledMeshes.size(); i<objects.size(); ++i) {
+		const Object &object = objects[i];
+		
+		for (DWord j=0; j<object.numVertexLists; ++j) {
+			VertexList &vertexList = vertexLists[object.firstVertexList + j];
+			vertexList.indexOffset = indexSize;
+			indexSize += sizeof(Word)*vertexList.numVerticesRefs;
+		}
+	}
+	
+	if (vertexSize == 0 || indexSize == 0)
+		return;
+	
+	PROFILE3DS_SCOPE(stats, LoadStats::bufferUpload, vertexSize + indexSize);
+	
+	GLuint buffers[2];
+	buffers3ds::genBuffers(2, buffers);
+	vertexBuffer = buffers[0];
+	indexBuffer = buffers[1];
+	
+	buffers3ds::bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	buffers3ds::bufferData(GL_ARRAY_BUFFER, vertexSize, NULL, GL_STATIC_DRAW);
+	
+	for (size_t i=0; i<objects.size(); ++i) {
+		const Object &object = objects[i];
+		
+		if (i < compiledMeshes.size()) {
+			const CompiledMesh &mesh = compiledMeshes[i];
+			if (!mesh.vertices.empty())
+				buffers3ds::bufferSubData(GL_ARRAY_BUFFER, object.vertexOffset, sizeof(CompiledVertex)*mesh.vertices.size(), &mesh.vertices[0]);
+			continue;
+		}
+		
+		buffers3ds::bufferSubData(GL_ARRAY_BUFFER, object.vertexOffset, sizeof(Vertex)*object.numVertices, object.vertices);
+		if (object.normals != NULL)
+			buffers3ds::bufferSubData(GL_ARRAY_BUFFER, object.normalOffset, sizeof(Vector)*object.numVertices, object.normals);
+		// files may have fewer map coords than vertices, the rest is undefined
+		if (object.mapCoords != NULL)
+			buffers3ds::bufferSubData(GL_ARRAY_BUFFER, object.mapCoordOffset, sizeof(MapCoord)*min(object.numMapCoords, object.numVertices), object.mapCoords);
+	}
+	
+	buffers3ds::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	buffers3ds::bufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize, NULL, GL_STATIC_DRAW);
+	
+	for (size_t i=0; i<compiledMeshes.size(); ++i) {
+		const CompiledMesh &mesh = compiledMeshes[i];
+		if (mesh.getNumIndices() != 0)
+			buffers3ds::bufferSubData(GL_ELEMENT_ARRAY_BUFFER, objects[i].indexOffset, mesh.getIndexSize()*mesh.getNumIndices(), mesh.getIndexData());
+	}
+	
+	for (size_t i=compiledMeshes.size(); i<objects.size(); ++i) {
+		const Object &object = objects[i];
+		
+		for (DWord j=0; j<object.numVertexLists; ++j) {
+			const VertexList &vertexList = vertexLists[object.firstVertexList + j];
+			buffers3ds::bufferSubData(GL_ELEMENT_ARRAY_BUFFER, vertexList.indexOffset, sizeof(Word)*vertexList.numVerticesRefs, vertexList.verticesRefs);
+		}
+	}
+	
+	buffers3ds::bindBuffer(GL_ARRAY_BUFFER, 0);
+	buffers3ds::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void Model3DS::compile()
+{
+	compiledMeshes.resize(objects.size());
+	
+	MeshCompiler compiler;
+	for (size_t i=0; i<objects.size(); ++i) {
+		DWord object = i;
+		compileObjects(compiler, &object, 1, compiledMeshes[i]);
+	}
+}
+
+void Model3DS::optimize(float *acmrBefore, float *acmrAfter)
+{
+	if (compiledMeshes.size() != objects.size())
+		compile();
+	
+	// weighted by the triangles of each mesh
+	double before = 0.0, after = 0.0;
+	size_t numTriangles = 0;
+	
+	for (size_t i=0; i<compiledMeshes.size(); ++i) {
+		CompiledMesh &mesh = compiledMeshes[i];
+		size_t n = mesh.getNumIndices() / 3;
+		
+		before += mesh3ds::getACMR(mesh) * n;
+		mesh3ds::optimizeVertexCache(mesh);
+		mesh3ds::optimizeVertexFetch(mesh);
+		after += mesh3ds::getACMR(mesh) * n;
+		numTriangles += n;
+	}
+	
+	if (numTriangles != 0) {
+		before /= numTriangles;
+		after /= numTriangles;
+	}
+	
+	LOG3DS_INFO("ACMR " << before << " -> " << after);
+	
+	if (acmrBefore != NULL)
+		*acmrBefore = before;
+	if (acmrAfter != NULL)
+		*acmrAfter = after;
+}
+
+void Model3DS::merge(const vector<DWord> &objectIndices, CompiledMesh &mesh) const
+{
+	MeshCompiler compiler;
+	compileObjects(compiler, objectIndices.empty() ? NULL : &objectIndices[0], objectIndices.size(), mesh);
+}
+
+void Model3DS::compileObjects(MeshCompiler &compiler, const DWord *objectIndices, size_t numObjects, CompiledMesh &mesh) const
+{
+	size_t maxVertices = 0, numIndices = 0;
+	for (size_t i=0; i<numObjects; ++i) {
+		const Object &object = objects[objectIndices[i]];
+		maxVertices += object.numVertices;
+		for (DWord j=0; j<object.numVertexLists; ++j)
+			numIndices += vertexLists[object.firstVertexList + j].numVerticesRefs;
+	}
+	
+	compiler.begin(mesh, maxVertices, numIndices);
+	
+	// a range per material, in the order the materials are first used
+	vector<DWord> order;
+	for (size_t i=0; i<numObjects; ++i) {
+		const Object &object = objects[objectIndices[i]];
+		for (DWord j=0; j<object.numVertexLists; ++j) {
+			DWord material = vertexLists[object.firstVertexList + j].material;
+			if (find(order.begin(), order.end(), material) == order.end())
+				order.push_back(material);
+		}
+	}
+	
+	for (size_t m=0; m<order.size(); ++m) {
+		for (size_t i=0; i<numObjects; ++i) {
+			const Object &object = objects[objectIndices[i]];
+			bool current = false;
 			
-			glEnable(GL_LIGHTING);
+			for (DWord j=0; j<object.numVertexLists; ++j) {
+				const VertexList &vertexList = vertexLists[object.firstVertexList + j];
+				if (vertexList.material != order[m])
+					continue;
+				
+				if (!current) {
+					compiler.setSource(object.vertices, object.normals, object.mapCoords, object.numVertices, object.numMapCoords);
+					current = true;
+				}
+				
+				compiler.addTriangles(vertexList.material, vertexList.verticesRefs, vertexList.numVerticesRefs);
+			}
 		}
+	}
+	
+	compiler.end();
+}
+
+void Model3DS::setProfiling(bool enabled)
+{
+	delete stats;
+	stats = enabled ? new LoadStats() : NULL;
+	arena.setStats(stats);
+}
+
+// textures are looked up relative to the model's directory
+void Model3DS::setPathOf(const char *fileName)
+{
+	const char *name = strrchr(fileName, '/');
+	if (name == NULL)
+		name = strrchr(fileName, '\\');
+	
+	setPath(fileName, name == NULL ? 0 : name - fileName + 1);
+}
+
+void Model3DS::setPath(const char *texturePath, size_t length)
+{
+	delete [] path;
+	path = new char[length+1];
+	memcpy(path, texturePath, length);
+	path[length] = '\0';
+	
+	LOG3DS_DEBUG("texture path: " << path);
+}
+
+void Model3DS::drawObject(DWord index, bool highlighted, const Frustum *frustum) const
+{
+	// the descendants of a subtree inside the frustum needn't be tested
+	if (frustum != NULL) {
+		Frustum::Overlap overlap = frustum->overlap(subtreeBounds[index]);
+		if (overlap == Frustum::outside)
+			return;
+		if (overlap == Frustum::inside)
+			frustum = NULL;
+	}
+	
+	const Object &object = objects[index];
+	bool highlight = object.selected || highlighted;
+	
+	glPushName(object.selectName);
+	
+	// without poses the empty objects are not placed at all
+	if (object.selected && (!poses.empty() || object.numVertices != 0)) {
+		Matrix parentWorld;
+		if (object.parent != noIndex)
+			parentWorld = worldMatrices[object.parent];
+		Matrix axes = parentWorld * getNodeMatrix(index);
 		
-		glRotatef(rotation.x, 1.f, 0.f, 0.f);
-		glRotatef(rotation.y, 0.f, 1.f, 0.f);
-		glRotatef(rotation.z, 0.f, 0.f, 1.f);
+		glPushMatrix();
+		glMultMatrixf(axes.m);
+		drawAxes();
+		glPopMatrix();
+	}
+	
+	if (object.numVertices != 0 && (frustum == NULL || frustum->overlap(meshBounds[index]) != Frustum::outside)) {
+		glPushMatrix();
+		glMultMatrixf(meshMatrices[index].m);
+		drawMesh(object, index, highlight);
+		glPopMatrix();
+	}
+	
+	for (DWord i=0; i<object.numChildren; ++i)
+		drawObject(children[object.firstChild + i], highlight, frustum);
+	
+	glPopName();
+}
+
+void Model3DS::drawAxes() const
+{
+	glDisable(GL_LIGHTING);
+	glLineWidth(2.f);
+	
+	glBegin(GL_LINES);
+	
+	glColor3f(1.f, 0.f, 0.f);
+	glVertex3f(0.f, 0.f, 0.f);
+	glVertex3f(20.f, 0.f, 0.f);
+	
+	glColor3f(0.f, 1.f, 0.f);
+	glVertex3f(0.f, 0.f, 0.f);
+	glVertex3f(0.f, 20.f, 0.f);
+	
+	glColor3f(0.f, 0.f, 1.f);
+	glVertex3f(0.f, 0.f, 0.f);
+	glVertex3f(0.f, 0.f, 20.f);
+	
+	glEnd();
+	
+	glEnable(GL_LIGHTING);
+}
+
+void Model3DS::drawMesh(const Object &object, size_t index, bool highlight) const
+{
+	if (index < compiledMeshes.size()) {
+		drawCompiled(object, compiledMeshes[index], highlight);
+		return;
+	}
+	
+	glEnableClientState(GL_VERTEX_ARRAY);
+	if (object.normals != NULL)
+		glEnableClientState(GL_NORMAL_ARRAY);
+	if (object.mapCoords != NULL)
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	
+	// with buffer objects bound the pointers are offsets into them
+	if (vertexBuffer != 0) {
+		glVertexPointer(3, GL_FLOAT, 0, reinterpret_cast<const GLvoid *>(object.vertexOffset));
+		glNormalPointer(GL_FLOAT, 0, reinterpret_cast<const GLvoid *>(object.normalOffset));
+		glTexCoordPointer(2, GL_FLOAT, 0, reinterpret_cast<const GLvoid *>(object.mapCoordOffset));
+	} else {
+		glVertexPointer(3, GL_FLOAT, 0, object.vertices);
+		glNormalPointer(GL_FLOAT, 0, object.normals);
+		glTexCoordPointer(2, GL_FLOAT, 0, object.mapCoords);
+	}
+	
+	for (DWord i=0; i<object.numVertexLists; ++i) {
+		const VertexList &vertexList = vertexLists[object.firstVertexList + i];
+		
+		applyMaterial(vertexList.material, highlight);
 		
-		glTranslatef(-pivot.x, -pivot.y, -pivot.z);
+		if (indexBuffer != 0)
+			glDrawElements(GL_TRIANGLES, vertexList.numVerticesRefs, GL_UNSIGNED_SHORT, reinterpret_cast<const GLvoid *>(vertexList.indexOffset));
+		else
+			glDrawElements(GL_TRIANGLES, vertexList.numVerticesRefs, GL_UNSIGNED_SHORT, vertexList.verticesRefs);
+	}
+	
+	glDisableClientState(GL_VERTEX_ARRAY);
+	if (object.normals != NULL)
+		glDisableClientState(GL_NORMAL_ARRAY);
+	if (object.mapCoords != NULL)
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+}
 
-		glMultMatrixf(mInv);
+void Model3DS::drawCompiled(const Object &object, const CompiledMesh &mesh, bool highlighted) const
+{
+	if (mesh.vertices.empty())
+		return;
+	
+	glEnableClientState(GL_VERTEX_ARRAY);
+	if (mesh.hasNormals)
+		glEnableClientState(GL_NORMAL_ARRAY);
+	if (mesh.hasMapCoords)
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	
+	const Byte *vertices = reinterpret_cast<const Byte *>(&mesh.vertices[0]);
+	const Byte *indices = static_cast<const Byte *>(mesh.getIndexData());
+	if (vertexBuffer != 0) {
+		vertices = reinterpret_cast<const Byte *>(object.vertexOffset);
+		indices = reinterpret_cast<const Byte *>(object.indexOffset);
+	}
+	
+	GLsizei stride = sizeof(CompiledVertex);
+	glVertexPointer(3, GL_FLOAT, stride, vertices + offsetof(CompiledVertex, position));
+	glNormalPointer(GL_FLOAT, stride, vertices + offsetof(CompiledVertex, normal));
+	glTexCoordPointer(2, GL_FLOAT, stride, vertices + offsetof(CompiledVertex, mapCoord));
+	
+	for (size_t i=0; i<mesh.ranges.size(); ++i) {
+		const CompiledMesh::Range &range = mesh.ranges[i];
+		
+		applyMaterial(range.material, highlighted);
+		glDrawElements(GL_TRIANGLES, range.numIndices, mesh.getIndexType(), indices + range.firstIndex*mesh.getIndexSize());
+	}
+	
+	glDisableClientState(GL_VERTEX_ARRAY);
+	if (mesh.hasNormals)
+		glDisableClientState(GL_NORMAL_ARRAY);
+	if (mesh.hasMapCoords)
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+}
+
+void Model3DS::applyMaterial(DWord index, bool highlighted) const
+{
+	const Material &material = materials[index];
+	
+	glMaterialfv(GL_FRONT, GL_DIFFUSE, reinterpret_cast<const GLfloat *>(&material.diffuse));
+	glMaterialfv(GL_FRONT, GL_SPECULAR, reinterpret_cast<const GLfloat *>(&material.specular));
+	
+	if (highlighted)
+		glMaterialfv(GL_FRONT, GL_AMBIENT, cfg3ds::selectedColor);
+	else
+		glMaterialfv(GL_FRONT, GL_AMBIENT, reinterpret_cast<const GLfloat *>(&material.ambient));
+	
+	if (material.texmapFile != NULL && textures != NULL && textures[material.textureRef] != 0) {
+		glEnable(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, textures[material.textureRef]);
+	}
+}
+
+void Model3DS::draw() const
+{
+	glLoadName(selectName);
+	
+	glPushMatrix();
+	
+	if (vertexBuffer != 0) {
+		buffers3ds::bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+		buffers3ds::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	}
+	
+	updateTransforms();
+	
+	if (culling) {
+		Matrix projection, modelview;
+		glGetFloatv(GL_PROJECTION_MATRIX, projection.m);
+		glGetFloatv(GL_MODELVIEW_MATRIX, modelview.m);
+		Frustum frustum(projection * modelview);
+		
+		for (size_t i=0; i<roots.size(); ++i)
+			drawObject(roots[i], false, &frustum);
+	} else {
+		for (size_t i=0; i<roots.size(); ++i)
+			drawObject(roots[i], false, NULL);
+	}
+	
+	// leave client arrays working for the caller
+	if (vertexBuffer != 0) {
+		buffers3ds::bindBuffer(GL_ARRAY_BUFFER, 0);
+		buffers3ds::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	
+	glPopMatrix();
+}
+
+const vector<Matrix> &Model3DS::getWorldMatrices() const
+{
+	updateTransforms();
+	return worldMatrices;
+}
+
+const vector<Matrix> &Model3DS::getMeshMatrices() const
+{
+	updateTransforms();
+	return meshMatrices;
+}
+
+const vector<BoundingBox> &Model3DS::getMeshBounds() const
+{
+	updateTransforms();
+	return meshBounds;
+}
+
+const vector<BoundingBox> &Model3DS::getSubtreeBounds() const
+{
+	updateTransforms();
+	return subtreeBounds;
+}
+
+BoundingBox Model3DS::getBounds() const
+{
+	updateTransforms();
+	
+	BoundingBox bounds;
+	for (size_t i=0; i<roots.size(); ++i)
+		bounds.add(subtreeBounds[roots[i]]);
+	return bounds;
+}
+
+void Model3DS::updateTransforms() const
+{
+	if (worldMatrices.size() != objects.size()) {
+		localMatrices.resize(objects.size());
+		worldMatrices.resize(objects.size());
+		meshMatrices.resize(objects.size());
+		meshBounds.resize(objects.size());
+		subtreeBounds.resize(objects.size());
+		dirtyObjects.assign(objects.size(), true);
+		transformsDirty = true;
+	}
+	
+	if (!transformsDirty)
+		return;
+	
+	for (size_t i=0; i<roots.size(); ++i)
+		updateTransform(roots[i], Matrix(), false);
+	transformsDirty = false;
+}
+
+// Returns whether anything in the subtree moved.
+bool Model3DS::updateTransform(DWord index, const Matrix &parentWorld, bool parentChanged) const
+{
+	const Object &object = objects[index];
+	bool changed = parentChanged || dirtyObjects[index];
+	
+	if (dirtyObjects[index]) {
+		if (!poses.empty() || object.numVertices != 0) {
+			localMatrices[index] = getNodeMatrix(index) *
+				Matrix::rotation(object.rotation.x, x) *
+				Matrix::rotation(object.rotation.y, y) *
+				Matrix::rotation(object.rotation.z, z);
+		} else
+			localMatrices[index] = Matrix();
+		
+		// without poses the children inherit the pivot too
+		if (poses.empty() && object.numVertices != 0)
+			localMatrices[index] = localMatrices[index] * getPivotMatrix(index);
+		
+		dirtyObjects[index] = false;
+	}
+	
+	if (changed) {
+		worldMatrices[index] = parentWorld * localMatrices[index];
+		meshMatrices[index] = (poses.empty() ? worldMatrices[index] : worldMatrices[index] * getPivotMatrix(index));
+		meshBounds[index] = object.bounds.transformed(meshMatrices[index]);
+	}
+	
+	bool childChanged = false;
+	for (DWord i=0; i<object.numChildren; ++i) {
+		if (updateTransform(children[object.firstChild + i], worldMatrices[index], changed))
+			childChanged = true;
+	}
+	
+	if (changed || childChanged) {
+		BoundingBox &bounds = subtreeBounds[index];
+		bounds = meshBounds[index];
+		for (DWord i=0; i<object.numChildren; ++i)
+			bounds.add(subtreeBounds[children[object.firstChild + i]]);
+	}
+	
+	return changed || childChanged;
+}
+
+// The object's placement up to its own axes, before the rotation of
+// rotateSelected().
+Matrix Model3DS::getNodeMatrix(DWord index) const
+{
+	const Object &object = objects[index];
+	Matrix node = Matrix::translation(object.position);
+	
+	if (!poses.empty()) {
+		// the keyframer's node transformation
+		const Pose &pose = poses[index];
+		
+		Matrix rotation;
+		anim3ds::toMatrix(pose.rotation, rotation.m);
+		
+		return node * Matrix::translation(pose.position) * rotation * Matrix::scaling(pose.scale);
+	}
+	
+	return node * Matrix::translation(object.origin) * Matrix::basis(object.u, object.v, object.w);
+}
+
+// Moves the mesh from where it was modelled to the object's pivot.
+Matrix Model3DS::getPivotMatrix(DWord index) const
+{
+	const Object &object = objects[index];
+	const Vector &u = object.u, &v = object.v, &w = object.w;
+	
+	// the inverse of the object's axes
+	Matrix inverse = Matrix::basis(Vector(u.x, v.x, w.x), Vector(u.y, v.y, w.y), Vector(u.z, v.z, w.z));
+	
+	return Matrix::translation(object.pivot * -1.f) * inverse * Matrix::translation(object.origin * -1.f);
+}
+
+void Model3DS::invalidateTransforms()
+{
+	dirtyObjects.assign(dirtyObjects.size(), true);
+	transformsDirty = true;
+}
+
+void Model3DS::invalidateTransform(DWord index)
+{
+	// a model that grew is updated whole anyway
+	if (index < dirtyObjects.size())
+		dirtyObjects[index] = true;
+	transformsDirty = true;
+}
+
+bool Model3DS::pick(const Vector &origin, const Vector &direction, RayHit &hit) const
+{
+	updateTransforms();
+	
+	hit = RayHit();
+	Vector inverseDirection = ray3ds::invert(direction);
+	
+	for (size_t i=0; i<roots.size(); ++i)
+		pickObject(roots[i], origin, direction, inverseDirection, hit);
+	
+	return hit.object != noIndex;
+}
 
-		glTranslatef(-origin.x, -origin.y, -origin.z);
-		
-		glEnableClientState(GL_VERTEX_ARRAY);
-		glEnableClientState(GL_NORMAL_ARRAY);
-		if (mapCoords != NULL)
-			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-		
-		glVertexPointer(3, GL_FLOAT, 0, vertices);
-		glNormalPointer(GL_FLOAT, 0, normals);
-		glTexCoordPointer(2, GL_FLOAT, 0, mapCoords);
-		
-		for (list<VertexList *>::const_iterator vIt = vertexLists.begin(); vIt != vertexLists.end(); ++vIt) {
-			glMaterialfv(GL_FRONT, GL_DIFFUSE, reinterpret_cast<GLfloat *>(&(*vIt)->material->diffuse));
-			glMaterialfv(GL_FRONT, GL_SPECULAR, reinterpret_cast<GLfloat *>(&(*vIt)->material->specular));
-			
-			if (selected || highlighted)
-				glMaterialfv(GL_FRONT, GL_AMBIENT, cfg3ds::selectedColor);
-			else
-				glMaterialfv(GL_FRONT, GL_AMBIENT, reinterpret_cast<GLfloat *>(&(*vIt)->material->ambient));
-			
-			if ((*vIt)->material->texmapFile != NULL) {
-				glEnable(GL_TEXTURE_2D);
-				glBindTexture(GL_TEXTURE_2D, (*textures)[(*vIt)->material->textureRef]);
-			}
-			
-			glDrawElements(GL_TRIANGLES, (*vIt)->numVerticesRefs, GL_UNSIGNED_SHORT, (*vIt)->verticesRefs);
-		}
+void Model3DS::pickObject(DWord index, const Vector &origin, const Vector &direction, const Vector &inverseDirection, RayHit &hit) const
+{
+	// nothing in the subtree is closer than the best hit so far
+	if (!ray3ds::intersectBox(origin, inverseDirection, subtreeBounds[index], hit.distance))
+		return;
+	
+	const Object &object = objects[index];
+	Matrix inverse;
+	
+	if (object.numFaces != 0 && ray3ds::intersectBox(origin, inverseDirection, meshBounds[index], hit.distance)
+		&& meshMatrices[index].getInverse(inverse)) {
+		// in the mesh's own space, where t is the same as outside it
+		Vector localOrigin = inverse.transformPoint(origin);
+		Vector localDirection = inverse.transformVector(direction);
 		
-		glDisableClientState(GL_VERTEX_ARRAY);
-		glDisableClientState(GL_NORMAL_ARRAY);
-		if (mapCoords != NULL)
-			glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		bool found;
+		if (index < bvhs.size() && !bvhs[index].isEmpty())
+			found = bvhs[index].intersectRay(localOrigin, localDirection, hit);
+		else
+			found = ray3ds::intersectFaces(localOrigin, localDirection, object.vertices, object.numVertices, object.faces, object.numFaces, hit);
 		
+		if (found)
+			hit.object = index;
 	}
 	
-	for (list<Object *>::const_iterator oIt = children.begin(); oIt != children.end(); ++oIt) {
-		(*oIt)->draw(selected || highlighted);
-	}
-
-	glPopMatrix();
-	
-	glPopName();
+	for (DWord i=0; i<object.numChildren; ++i)
+		pickObject(children[object.firstChild + i], origin, direction, inverseDirection, hit);
 }
 
-void Model3DS::draw() const
+void Model3DS::animate(GLfloat frame)
 {
-	glLoadName(selectName);
+	if (sampler == NULL || poses.size() != objects.size()) {
+		delete sampler;
+		sampler = new AnimationSampler(*this);
+		// from the static placement to the poses
+		poses.resize(objects.size());
+		invalidateTransforms();
+	}
 	
-	glPushMatrix();
+	if (poses.empty())
+		return;
 	
-	for (list<Object *>::const_iterator oIt = roots.begin(); oIt != roots.end(); ++oIt) {
-		(*oIt)->draw();
-	}
+	sampler->sample(frame, &poses[0]);
 	
-	glPopMatrix();
+	// the objects with a single key stay where they are
+	for (size_t i=0; i<objects.size(); ++i) {
+		const Object &object = objects[i];
+		if (object.positionTrack.numKeys > 1 || object.rotationTrack.numKeys > 1 || object.scaleTrack.numKeys > 1)
+			invalidateTransform(i);
+	}
 }
 
 void Model3DS::select(GLint selectedName)
 {
 	if (selectedName == -1)
-		selectedObject = NULL;
+		selectedObject = noIndex;
 	
-	for (list<Object *>::const_iterator it = objects.begin(); it != objects.end(); ++it) {
-		if ((*it)->selectName == static_cast<GLuint>(selectedName)) {
-			(*it)->selected = true;
-			selectedObject = *it;
+	for (size_t i=0; i<objects.size(); ++i) {
+		if (objects[i].selectName == static_cast<GLuint>(selectedName)) {
+			objects[i].selected = true;
+			selectedObject = i;
 		} else {
-			(*it)->selected = false;
+			objects[i].selected = false;
 		}
 	}
 }
 
 void Model3DS::rotateSelected(GLfloat delta, Axis axis)
 {
-	if (selectedObject == NULL)
+	if (selectedObject == noIndex)
 		return;
 	
+	Vector &rotation = objects[selectedObject].rotation;
+	invalidateTransform(selectedObject);
+	
 	switch (axis) {
-		case x: selectedObject->rotation.x += delta; break;
-		case y: selectedObject->rotation.y += delta; break;
-		case z: selectedObject->rotation.z += delta; break;
+		case x: rotation.x += delta; break;
+		case y: rotation.y += delta; break;
+		case z: rotation.z += delta; break;
 	}
 }
 
 void Model3DS::translateSelected(GLfloat delta, Axis axis)
 {
-	if (selectedObject == NULL)
+	if (selectedObject == noIndex)
 		return;
 	
+	Vector &position = objects[selectedObject].position;
+	invalidateTransform(selectedObject);
+	
 	switch (axis) {
-		case x: selectedObject->position.x += delta; break;
-		case y: selectedObject->position.y += delta; break;
-		case z: selectedObject->position.z += delta; break;
+		case x: position.x += delta; break;
+		case y: position.y += delta; break;
+		case z: position.z += delta; break;
 	}
 }
 
-void Model3DS::parse()
+bool Model3DS::parseRoot()
 {
 	readChunkHeader();
 	
-	if (currentChunk.id == chunks::MAIN)
-		parseMain();
-	else
-		exit(1);
+	if (currentChunk.id != chunks::MAIN)
+		return false;
+	
+	parseMain();
+	return true;
 }
 
 void Model3DS::parseMain()
 {
-	cout << "parseMain" << endl;
+	LOG3DS_DEBUG("parseMain");
 	DWord length = currentChunk.length;
 	DWord n = cfg3ds::chunkHeaderSize;
 	
-	while (n < length)
+	while (n < length && !truncated)
 	{
 		readChunkHeader();
 		n += currentChunk.length;
@@ -270,13 +1326,11 @@ void Model3DS::parseMain()
 
 void Model3DS::parseEdit()
 {
-	cout << "parseEdit" << endl;
+	LOG3DS_DEBUG("parseEdit");
 	DWord length = currentChunk.length;
 	DWord n = cfg3ds::chunkHeaderSize;
 	
-	numTextures = 0;
-	
-	while (n < length)
+	while (n < length && !truncated)
 	{
 		readChunkHeader();
 		n += currentChunk.length;
@@ -294,57 +1348,23 @@ void Model3DS::parseEdit()
 				skipChunk();
 		}
 	}
-	
-	textures = new GLuint[numTextures];
-	glGenTextures(numTextures, textures);
-	
-	for (list<Material *>::iterator it = materials.begin(); it != materials.end(); ++it) {
-		if ((*it)->texmapFile == NULL)
-			continue;
-		
-		char *texmapFileName = new char[strlen(path) + strlen((*it)->texmapFile) + 1];
-		sprintf(texmapFileName, "%s%s", path, (*it)->texmapFile);
-		
-		sf::Image image;
-		bool result = image.LoadFromFile(texmapFileName);
-		delete [] texmapFileName;
-		
-		if (result == false) {
-			cout << "Can't read texture file!" << endl;
-			(*it)->texmapFile = NULL;
-			continue;
-		}
-		
-		glBindTexture(GL_TEXTURE_2D, textures[(*it)->textureRef]);
-				
-		// select modulate to mix texture with color for shading
-		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-		
-		// when texture area is small, bilinear filter the closest mipmap
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		// when texture area is large, bilinear filter the original
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		// the texture wraps over at the edges (repeat)
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		
-		gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGBA, image.GetWidth(), image.GetHeight(), GL_RGBA, GL_UNSIGNED_BYTE, image.GetPixelsPtr());
-	}
 }
 
 void Model3DS::parseObject()
 {
-	cout << "parseObject" << endl;
+	LOG3DS_DEBUG("parseObject");
 	DWord length = currentChunk.length;
 	
-	Object *object = new Object(textures, currentSelectName++);
+	objects.push_back(Object(currentSelectName++));
+	Object *object = &objects.back();
+	object->firstVertexList = vertexLists.size();
 	
 	DWord n = cfg3ds::chunkHeaderSize;
-	n += readString(object->name);
-	cout << "\tname: " << object->name << endl;
+	n += readString(object->nameId);
+	object->name = strings.get(object->nameId);
+	LOG3DS_DEBUG("\tname: " << object->name);
 	
-	while (n < length)
+	while (n < length && !truncated)
 	{
 		readChunkHeader();
 		n += currentChunk.length;
@@ -359,53 +1379,51 @@ void Model3DS::parseObject()
 		}
 	}
 	
-	for (int i=0; i<object->numVertices; ++i)
-		object->normals[i].normalize();
-	
-	objects.push_back(object);
+	addByName(objectsByName, object->nameId, objects.size()-1);
 }
 
 void Model3DS::parseMesh(Object *object)
 {
-	cout << "parseMesh" << endl;
+	LOG3DS_DEBUG("parseMesh");
 	DWord length = currentChunk.length;
 	DWord n = cfg3ds::chunkHeaderSize;
 	
-	while (n < length)
+	while (n < length && !truncated)
 	{
 		readChunkHeader();
 		n += currentChunk.length;
 		switch (currentChunk.id)
 		{
 			case chunks::MESH_VERTICES:
+			{
+				PROFILE3DS_SCOPE(stats, LoadStats::vertices, currentChunk.length);
+				
 				read(object->numVertices);
-				object->vertices = new Vertex[object->numVertices];
-				object->normals = new Vector[object->numVertices];
-				memset(object->normals, 0, sizeof(Vector)*object->numVertices);
-				
-				for (int i=0; i<object->numVertices; ++i) {
-					read(object->vertices[i].x);
-					read(object->vertices[i].y);
-					read(object->vertices[i].z);
-				}
+				object->vertices = allocate<Vertex>(object->numVertices);
+				
+				// the file stores tightly packed x, y, z floats just like Vertex
+				readBytes(object->vertices, sizeof(Vertex)*object->numVertices);
 				break;
+			}
 				
 			case chunks::MESH_FACES:
 				parseFaces(object);
 				break;
 				
 			case chunks::MESH_MAPCOORDS:
+			{
+				PROFILE3DS_SCOPE(stats, LoadStats::mapCoords, currentChunk.length);
+				
 				Word numEntries;
 				read(numEntries);
 				
-				object->mapCoords = new MapCoord[numEntries];
+				object->mapCoords = allocate<MapCoord>(numEntries);
+				object->numMapCoords = numEntries;
 				
-				for (int i=0; i<numEntries; ++i) {
-					read(object->mapCoords[i].u);
-					read(object->mapCoords[i].v);
-				}
+				readBytes(object->mapCoords, sizeof(MapCoord)*numEntries);
 				
 				break;
+			}
 				
 			case chunks::MESH_LOCALCOORDS:
 				read(object->u);
@@ -427,76 +1445,77 @@ void Model3DS::parseMesh(Object *object)
 
 void Model3DS::parseFaces(Object *object)
 {
-	cout << "parseFaces" << endl;
+	LOG3DS_DEBUG("parseFaces");
 	DWord length = currentChunk.length;
 	DWord n = cfg3ds::chunkHeaderSize;
 	
 	n += read(object->numFaces);
 	
-	object->faces = new Face[object->numFaces];
+	object->faces = allocate<Face>(object->numFaces);
 	
-	Word faceFlag;
-
-	for (int i=0; i<object->numFaces; ++i) {
-		n += read(object->faces[i].vertexA);
-		n += read(object->faces[i].vertexB);
-		n += read(object->faces[i].vertexC);
-		n += read(faceFlag);
-		
-		Vector vectorAB = object->vertices[object->faces[i].vertexB] - object->vertices[object->faces[i].vertexA];
-		Vector vectorBC = object->vertices[object->faces[i].vertexC] - object->vertices[object->faces[i].vertexB];
-		
-		Vector faceNormal = vectorAB * vectorBC;
+	{
+		PROFILE3DS_SCOPE(stats, LoadStats::faces, currentChunk.length);
 		
-		object->normals[object->faces[i].vertexA] += faceNormal;
-		object->normals[object->faces[i].vertexB] += faceNormal;
-		object->normals[object->faces[i].vertexC] += faceNormal;
+		// the face records are three vertex indices and a flag word like Face
+		size_t size = sizeof(Face)*object->numFaces;
+		if (readBytes(object->faces, size) != size)
+			throw runtime_error("Face list exceeds the end of data!");
+		n += size;
 	}
 	
-	VertexList *vertexList;
-	
-	while (n < length) {
+	while (n < length && !truncated) {
 		readChunkHeader();
 		n += currentChunk.length;
 		
 		switch (currentChunk.id) {
 			case chunks::FACES_MATERIALS:
-				vertexList = new VertexList();
-				
-				char *materialName;
-				readString(materialName);
+			{
+				PROFILE3DS_SCOPE(stats, LoadStats::faceMaterials, currentChunk.length);
 				
-				// find the material
+				vertexLists.push_back(VertexList());
+				VertexList *vertexList = &vertexLists.back();
+				++object->numVertexLists;
 				
-				for (list<Material *>::const_iterator it = materials.begin(); it != materials.end(); ++it) {
-					if (strcmp((*it)->name, materialName) == 0) {
-						vertexList->material = *it;
-						break;
-					}
-				}
+				StringId materialName;
+				readString(materialName);
 				
-				delete [] materialName;
+				vertexList->material = findByName(materialsByName, materialName);
 				
-				if (vertexList->material == NULL)
+				if (vertexList->material == noIndex)
 					throw runtime_error("Needed material not found in materials list!");
 				
 				Word numEntries;
 				read(numEntries);
 				
 				vertexList->numVerticesRefs = numEntries * 3; // *3 because there are 3 vertices per face
-				vertexList->verticesRefs = new Word[vertexList->numVerticesRefs];
+				vertexList->verticesRefs = allocate<Word>(vertexList->numVerticesRefs);
+				
+				// the face numbers are turned into vertex indices once the
+				// normals have been built, see expandVertexLists()
+				readBytes(vertexList->verticesRefs, sizeof(Word)*numEntries);
 				
-				Word faceRef;
+				for (Word i=0; i<numEntries; ++i) {
+					if (vertexList->verticesRefs[i] >= object->numFaces)
+						throw runtime_error("Material refers to a face that doesn't exist!");
+				}
 				
-				for (unsigned int i=0; i<vertexList->numVerticesRefs; i+=3) {
-					read(faceRef);
-					vertexList->verticesRefs[i] = object->faces[faceRef].vertexA;
-					vertexList->verticesRefs[i+1] = object->faces[faceRef].vertexB;
-					vertexList->verticesRefs[i+2] = object->faces[faceRef].vertexC;
+				break;
+			}
+			
+			case chunks::FACES_SMOOTHING:
+			{
+				// a group mask per face
+				size_t size = sizeof(DWord)*object->numFaces;
+				if (currentChunk.length - cfg3ds::chunkHeaderSize < size) {
+					skipChunk();
+					break;
 				}
 				
-				object->vertexLists.push_back(vertexList);
+				object->smoothingGroups = allocate<DWord>(object->numFaces);
+				readBytes(object->smoothingGroups, size);
+				skip(currentChunk.length - cfg3ds::chunkHeaderSize - size);
 				break;
+			}
 			
 			default:
 				skipChunk();
@@ -504,22 +1523,265 @@ void Model3DS::parseFaces(Object *object)
 	}
 }
 
+namespace
+{
+	const size_t smallObjectsPerRange = 16;
+	const size_t facesPerRange = 4096;
+	
+	// objects of a model whose normals are built one per thread
+	struct FinishContext
+	{
+		Model3DS *model;
+		vector<DWord> objects;
+	};
+	
+	struct MoreFaces
+	{
+		MoreFaces(const vector<Object> &objects): objects(objects) {}
+		
+		bool operator ()(DWord a, DWord b) const { return objects[a].numFaces > objects[b].numFaces; }
+		
+		const vector<Object> &objects;
+	};
+	
+	// a large object whose faces and vertices are split over threads
+	struct SplitContext
+	{
+		normals3ds::MeshNormals *meshNormals;
+		Vector *normals;
+	};
+	
+	void computeCorners(void *context, size_t begin, size_t end)
+	{
+		static_cast<SplitContext *>(context)->meshNormals->computeCorners(begin, end);
+	}
+	
+	void gatherNormals(void *context, size_t begin, size_t end)
+	{
+		SplitContext *split = static_cast<SplitContext *>(context);
+		split->meshNormals->gather(split->normals, begin, end);
+	}
+}
+
+void Model3DS::finishMeshes()
+{
+	PROFILE3DS_SCOPE(stats, LoadStats::normals, 0);
+	
+	FinishContext context;
+	context.model = this;
+	
+	// large objects use all the threads one after the other, the small
+	// ones are spread over the threads
+	normals3ds::MeshNormals meshNormals;
+	for (size_t i=numFinishedObjects; i<objects.size(); ++i) {
+		if (objects[i].numFaces >= cfg3ds::largeMeshFaces && normalThreads > 1)
+			finishObject(objects[i], meshNormals, normalThreads);
+		else
+			context.objects.push_back(i);
+	}
+	
+	parallel3ds::forEachRange(context.objects.size(), smallObjectsPerRange, finishObjects, &context, normalThreads);
+	numFinishedObjects = objects.size();
+}
+
+void Model3DS::buildBVHs()
+{
+	PROFILE3DS_SCOPE(stats, LoadStats::bvhs, 0);
+	
+	bvhs.resize(objects.size());
+	
+	// the largest first, so the threads end together
+	FinishContext context;
+	context.model = this;
+	for (size_t i=0; i<objects.size(); ++i) {
+		// not for the meshes dropped for bad faces, which have no bounds
+		if (bvhs[i].isEmpty() && objects[i].numFaces != 0 && !objects[i].bounds.isEmpty())
+			context.objects.push_back(i);
+	}
+	sort(context.objects.begin(), context.objects.end(), MoreFaces(objects));
+	
+	parallel3ds::forEachRange(context.objects.size(), 1, buildObjectBVHs, &context, normalThreads);
+}
+
+void Model3DS::buildObjectBVHs(void *context, size_t begin, size_t end)
+{
+	FinishContext *build = static_cast<FinishContext *>(context);
+	
+	for (size_t i=begin; i<end; ++i) {
+		DWord index = build->objects[i];
+		const Object &object = build->model->objects[index];
+		build->model->bvhs[index].build(object.vertices, object.numVertices, object.faces, object.numFaces);
+	}
+}
+
+void Model3DS::finishObjects(void *context, size_t begin, size_t end)
+{
+	FinishContext *finish = static_cast<FinishContext *>(context);
+	normals3ds::MeshNormals meshNormals;
+	
+	for (size_t i=begin; i<end; ++i)
+		finish->model->finishObject(finish->model->objects[finish->objects[i]], meshNormals, 1);
+}
+
+void Model3DS::finishObject(Object &object, normals3ds::MeshNormals &meshNormals, unsigned int numThreads)
+{
+	for (Word i=0; i<object.numFaces; ++i) {
+		const Face &face = object.faces[i];
+		if (face.vertexA >= object.numVertices || face.vertexB >= object.numVertices || face.vertexC >= object.numVertices) {
+			LOG3DS_WARNING(object.name << ": a face refers to a vertex that doesn't exist, the mesh is dropped");
+			
+			for (DWord j=0; j<object.numVertexLists; ++j)
+				vertexLists[object.firstVertexList + j].numVerticesRefs = 0;
+			return;
+		}
+	}
+	
+	// splitting the vertices below only duplicates them
+	for (Word i=0; i<object.numVertices; ++i)
+		object.bounds.add(object.vertices[i]);
+	
+	bool split = smoothing && object.smoothingGroups != NULL;
+	
+	if (normalMode == areaWeightedNormals && !split) {
+		// nothing to split, the faces are simply added up
+		object.normals = allocate<Vector>(object.numVertices);
+		
+		if (soaLayout) {
+			object.soaVertices = allocateArrays(object.numVertices);
+			object.soaNormals = allocateArrays(object.numVertices);
+			
+			for (Word i=0; i<object.numVertices; ++i) {
+				object.soaVertices.x[i] = object.vertices[i].x;
+				object.soaVertices.y[i] = object.vertices[i].y;
+				object.soaVertices.z[i] = object.vertices[i].z;
+			}
+			
+			memset(object.soaNormals.x, 0, sizeof(GLfloat)*object.numVertices);
+			memset(object.soaNormals.y, 0, sizeof(GLfloat)*object.numVertices);
+			memset(object.soaNormals.z, 0, sizeof(GLfloat)*object.numVertices);
+			
+			normals3ds::accumulate(object.soaVertices, object.faces, object.numFaces, object.soaNormals);
+			normals3ds::normalize(object.soaNormals, object.numVertices);
+			
+			for (Word i=0; i<object.numVertices; ++i) {
+				object.normals[i].x = object.soaNormals.x[i];
+				object.normals[i].y = object.soaNormals.y[i];
+				object.normals[i].z = object.soaNormals.z[i];
+			}
+		} else {
+			fill(object.normals, object.normals + object.numVertices, Vector());
+			normals3ds::accumulate(object.vertices, object.faces, object.numFaces, object.normals);
+			normals3ds::normalize(object.normals, object.numVertices);
+		}
+		
+		expandVertexLists(object);
+		return;
+	}
+	
+	if (normalMode != skipNormals) {
+		meshNormals.begin(object.vertices, object.numVertices, object.faces, object.numFaces, object.smoothingGroups,
+			normalMode == angleWeightedNormals ? normals3ds::angleWeighted : normals3ds::areaWeighted);
+		
+		SplitContext context;
+		context.meshNormals = &meshNormals;
+		parallel3ds::forEachRange(object.numFaces, facesPerRange, computeCorners, &context, numThreads);
+		
+		size_t numVertices = meshNormals.link(split);
+		if (numVertices > 0xFFFF) {
+			// the vertex lists index vertices with a Word
+			LOG3DS_WARNING(object.name << ": too many vertices to split by smoothing groups, they are ignored");
+			numVertices = meshNormals.link(false);
+		}
+		
+		if (numVertices != object.numVertices) {
+			Vertex *vertices = allocate<Vertex>(numVertices);
+			for (size_t i=0; i<numVertices; ++i)
+				vertices[i] = object.vertices[meshNormals.getSource(i)];
+			object.vertices = vertices;
+			
+			if (object.mapCoords != NULL) {
+				MapCoord *mapCoords = allocate<MapCoord>(numVertices);
+				for (size_t i=0; i<numVertices; ++i) {
+					Word source = meshNormals.getSource(i);
+					if (source < object.numMapCoords)
+						mapCoords[i] = object.mapCoords[source];
+					else
+						mapCoords[i].u = mapCoords[i].v = 0.f;
+				}
+				object.mapCoords = mapCoords;
+				object.numMapCoords = numVertices;
+			}
+			
+			meshNormals.remapFaces(object.faces);
+			object.numVertices = numVertices;
+		}
+		
+		object.normals = allocate<Vector>(numVertices);
+		context.normals = object.normals;
+		parallel3ds::forEachRange(numVertices, facesPerRange, gatherNormals, &context, numThreads);
+	}
+	
+	expandVertexLists(object);
+	
+	if (soaLayout)
+		deinterleave(object);
+}
+
+void Model3DS::deinterleave(Object &object)
+{
+	object.soaVertices = allocateArrays(object.numVertices);
+	for (Word i=0; i<object.numVertices; ++i) {
+		object.soaVertices.x[i] = object.vertices[i].x;
+		object.soaVertices.y[i] = object.vertices[i].y;
+		object.soaVertices.z[i] = object.vertices[i].z;
+	}
+	
+	if (object.normals != NULL) {
+		object.soaNormals = allocateArrays(object.numVertices);
+		for (Word i=0; i<object.numVertices; ++i) {
+			object.soaNormals.x[i] = object.normals[i].x;
+			object.soaNormals.y[i] = object.normals[i].y;
+			object.soaNormals.z[i] = object.normals[i].z;
+		}
+	}
+}
+
+void Model3DS::expandVertexLists(const Object &object)
+{
+	for (DWord i=0; i<object.numVertexLists; ++i) {
+		VertexList &vertexList = vertexLists[object.firstVertexList + i];
+		Word *refs = vertexList.verticesRefs;
+		
+		// backwards, each face number is read before its slot is overwritten
+		for (DWord j=vertexList.numVerticesRefs/3; j-- > 0; ) {
+			const Face &face = object.faces[refs[j]];
+			refs[3*j] = face.vertexA;
+			refs[3*j + 1] = face.vertexB;
+			refs[3*j + 2] = face.vertexC;
+		}
+	}
+}
+
 void Model3DS::parseMaterial()
 {
-	cout << "parseMaterial" << endl;
+	LOG3DS_DEBUG("parseMaterial");
 	DWord length = currentChunk.length;
 	DWord n = cfg3ds::chunkHeaderSize;
 	
-	Material *material = new Material();
+	PROFILE3DS_SCOPE(stats, LoadStats::materials, length);
 	
-	while (n < length)
+	materials.push_back(Material());
+	Material *material = &materials.back();
+	
+	while (n < length && !truncated)
 	{
 		readChunkHeader();
 		n += currentChunk.length;
 		switch (currentChunk.id)
 		{
 			case chunks::MATERIAL_NAME:
-				readString(material->name);
+				readString(material->nameId);
+				material->name = strings.get(material->nameId);
 				break;
 			
 			case chunks::MATERIAL_AMBIENT:
@@ -543,17 +1805,17 @@ void Model3DS::parseMaterial()
 		}
 	}
 	
-	cout << "\tname: " << material->name << endl;
-	materials.push_back(material);
+	LOG3DS_DEBUG("\tname: " << material->name);
+	addByName(materialsByName, material->nameId, materials.size()-1);
 }
 
 void Model3DS::parseTexmap(Material *material)
 {
-	cout << "parseTexmap" << endl;
+	LOG3DS_DEBUG("parseTexmap");
 	DWord length = currentChunk.length;
 	DWord n = cfg3ds::chunkHeaderSize;
 	
-	while (n < length)
+	while (n < length && !truncated)
 	{
 		readChunkHeader();
 		n += currentChunk.length;
@@ -561,11 +1823,12 @@ void Model3DS::parseTexmap(Material *material)
 		{
 			case chunks::TEXMAP_FILE:
 			{
-				readString(material->texmapFile);
-				cout << material->texmapFile << endl;
-				
-				material->textureRef = numTextures++;
+				StringId texmapFile;
+				readString(texmapFile);
+				material->texmapFile = strings.get(texmapFile);
+				LOG3DS_DEBUG(material->texmapFile);
 				
+				material->textureRef = addTexture(material->texmapFile);
 				break;
 			}
 			
@@ -577,99 +1840,106 @@ void Model3DS::parseTexmap(Material *material)
 
 void Model3DS::parseKeyframer()
 {
-	cout << "parseKeyframer" << endl;
+	LOG3DS_DEBUG("parseKeyframer");
 	DWord length = currentChunk.length;
 	DWord n = cfg3ds::chunkHeaderSize;
 	
-	while (n < length)
+	PROFILE3DS_SCOPE(stats, LoadStats::keyframer, length);
+	
+	Hierarchy state;
+	state.dummyName = strings.intern("$$$DUMMY");
+	
+	while (n < length && !truncated)
 	{
 		readChunkHeader();
 		n += currentChunk.length;
 		switch (currentChunk.id)
 		{
+			case chunks::KEYFRAMER_FRAMES:
+				// a chunk too short for both frames keeps the defaults
+				if (currentChunk.length < cfg3ds::chunkHeaderSize + 2*sizeof(DWord)) {
+					LOG3DS_WARNING("keyframer frames chunk too short, ignored");
+					skipChunk();
+					break;
+				}
+				read(firstFrame);
+				read(lastFrame);
+				skip(currentChunk.length - cfg3ds::chunkHeaderSize - 2*sizeof(DWord));
+				break;
+			
 			case chunks::KEYFRAMER_MESHINFO:
-				parseMeshinfo();
+				parseMeshinfo(state);
 				break;
 				
 			default:
 				skipChunk();
 		}
 	}
+	
+	linkChildren(state.links);
 }
 
-void Model3DS::parseMeshinfo()
+void Model3DS::parseMeshinfo(Hierarchy &state)
 {
-	//cout << "parseMeshinfo" << endl;
+	LOG3DS_DEBUG("parseMeshinfo");
 	DWord length = currentChunk.length;
 	DWord n = cfg3ds::chunkHeaderSize;
 
 	Object *object = NULL;
 
-	while (n < length)
+	while (n < length && !truncated)
 	{
 		readChunkHeader();
 		n += currentChunk.length;
 		switch (currentChunk.id)
 		{
 			case chunks::MESHINFO_HIERARCHY:
-				char *name;
+				StringId nameId;
 				Word flag1, flag2, hierarchy;
+				DWord index;
 				object = NULL;
 				
-				readString(name);
-				
-//				if (strcmp(name, "$$$DUMMY") == 0)
-//					break;
+				readString(nameId);
 				
 				read(flag1);
 				read(flag2);
 				read(hierarchy);
-				cout << name << " " << static_cast<short int>(hierarchy) << endl;
-				for (list<Object *>::const_iterator it = objects.begin(); it != objects.end(); ++it) {
-					if (strcmp((*it)->name, name) == 0) {
-						object = *it;
-						break;
-					}
-				}
+				LOG3DS_DEBUG(strings.get(nameId) << " " << static_cast<short int>(hierarchy));
+				index = findByName(objectsByName, nameId);
 				
-				if (object == NULL) {
-					delete [] name;
+				if (index == noIndex)
 					break;
-				}
 				
-				if ((static_cast<short int>(hierarchy) <= rootLevel && strcmp(name, "$$$DUMMY") != 0) || previousObject == NULL) {
-					cout << "adding root: " << name << endl;
-					roots.push_back(object);
-					parents.resize(static_cast<short int>(hierarchy)+2);
-					parents[static_cast<short int>(hierarchy)+1] = object;
-					currentParent = object;
-					rootLevel = static_cast<short int>(hierarchy);
+				object = &objects[index];
+				
+				if ((static_cast<short int>(hierarchy) <= state.rootLevel && nameId != state.dummyName) || state.previousObject == noIndex) {
+					LOG3DS_DEBUG("adding root: " << strings.get(nameId));
+					roots.push_back(index);
+					state.parents.resize(static_cast<short int>(hierarchy)+2, noIndex);
+					state.parents[static_cast<short int>(hierarchy)+1] = index;
+					state.currentParent = index;
+					state.rootLevel = static_cast<short int>(hierarchy);
 				} else {
 					
-					if (static_cast<short int>(hierarchy) > previousLevel) {
-						currentParent = previousObject;
-						parents.resize(hierarchy+1);
-						parents[hierarchy] = currentParent;
-					} else if (static_cast<short int>(hierarchy) < previousLevel)
-						currentParent = parents[hierarchy];
+					if (static_cast<short int>(hierarchy) > state.previousLevel) {
+						state.currentParent = state.previousObject;
+						state.parents.resize(hierarchy+1, noIndex);
+						state.parents[hierarchy] = state.currentParent;
+					} else if (static_cast<short int>(hierarchy) < state.previousLevel)
+						state.currentParent = state.parents[hierarchy];
 					
-					cout << "adding " << name << " " << object->selectName << " to " << currentParent->name << endl;
-					currentParent->children.push_back(object);
-				}
-				
-				for (int i=0; i<object->numVertices; i+=1) {
-					// cout << object->vertices[i].x << " " << object->vertices[i].y << " " << object->vertices[i].z << endl;
+					if (state.currentParent != noIndex) {
+						LOG3DS_DEBUG("adding " << strings.get(nameId) << " " << object->selectName << " to " << objects[state.currentParent].name);
+						state.links.push_back(make_pair(state.currentParent, index));
+					}
 				}
 				
-				cout << object->u.x << " " << object->v.x << " " << object->w.x << " " << object->origin.x << endl;
-				cout << object->u.y << " " << object->v.y << " " << object->w.y << " " << object->origin.y << endl;
-				cout << object->u.z << " " << object->v.z << " " << object->w.z << " " << object->origin.z << endl;
-				cout << 0.f << " " << 0.f << " " << 0.f << " " << 1.f << endl;
-				
-				previousLevel = static_cast<short int>(hierarchy);
-				previousObject = object;
+				LOG3DS_DEBUG(object->u.x << " " << object->v.x << " " << object->w.x << " " << object->origin.x);
+				LOG3DS_DEBUG(object->u.y << " " << object->v.y << " " << object->w.y << " " << object->origin.y);
+				LOG3DS_DEBUG(object->u.z << " " << object->v.z << " " << object->w.z << " " << object->origin.z);
 				
-				delete [] name;
+				state.previousLevel = static_cast<short int>(hierarchy);
+				state.previousObject = index;
 				break;
 			
 			case chunks::MESHINFO_PIVOT:
@@ -679,7 +1949,7 @@ void Model3DS::parseMeshinfo()
 				}
 					
 				read(object->pivot);
-				cout << "pivot: " << object->pivot.x << " " << object->pivot.y << " " << object->pivot.z << endl;
+				LOG3DS_DEBUG("pivot: " << object->pivot.x << " " << object->pivot.y << " " << object->pivot.z);
 			
 				break;
 				
@@ -691,44 +1961,7 @@ void Model3DS::parseMeshinfo()
 					break;
 				}
 			
-				Word flag;
-				DWord unknown, keys;
-				
-				read(flag);
-				read(unknown);
-				read(unknown);
-				read(keys);
-				
-				for (unsigned int i=0; i<keys; ++i) {
-					DWord key;
-					Word accelFlag;
-					
-					read(key);
-					read(accelFlag);
-					
-					// Let's assume accelFlag is always 0 and skip to the track specific data
-					
-					switch (currentChunk.id) {
-						case chunks::MESHINFO_POSTRACK:
-							read(object->postrack);
-							cout << "postrack:\t" << object->postrack.x << " " << object->postrack.y << " " << object->postrack.z << endl;
-							break;
-						
-						case chunks::MESHINFO_ROTTRACK:
-							read(object->rottrackAngle);
-							read(object->rottrackAxis);
-							cout << "rottrack:\t" << object->rottrackAxis.x << " " << object->rottrackAxis.y << " " << object->rottrackAxis.z << " " << object->rottrackAngle << endl;
-							break;
-							
-						case chunks::MESHINFO_SCALETRACK:
-							read(object->scaletrackX);
-							read(object->scaletrackY);
-							read(object->scaletrackZ);
-							cout << "scaletrack:\t" << object->scaletrackX << " " << object->scaletrackY << " " << object->scaletrackZ << endl;
-							break;
-					}
-				}
-				
+				parseTrack(object);
 				break;
 			
 			default:
@@ -737,13 +1970,186 @@ void Model3DS::parseMeshinfo()
 	}
 }
 
+void Model3DS::parseTrack(Object *object)
+{
+	Word id = currentChunk.id;
+	DWord length = currentChunk.length;
+	
+	Word flags;
+	DWord unknown, numKeys;
+	read(flags);
+	read(unknown);
+	read(unknown);
+	read(numKeys);
+	DWord n = cfg3ds::chunkHeaderSize + sizeof(flags) + 2*sizeof(unknown) + sizeof(numKeys);
+	
+	Track track;
+	track.flags = flags;
+	track.firstKey = (id == chunks::MESHINFO_POSTRACK ? positionKeys.size() : id == chunks::MESHINFO_ROTTRACK ? rotationKeys.size() : scaleKeys.size());
+	
+	DWord valueSize = (id == chunks::MESHINFO_ROTTRACK ? sizeof(GLfloat) + sizeof(Vector) : sizeof(Vector));
+	DWord previousFrame = 0;
+	
+	for (DWord i=0; i<numKeys; ++i) {
+		DWord frame;
+		Word keyFlags;
+		
+		if (n + sizeof(frame) + sizeof(keyFlags) > length)
+			break;
+		read(frame);
+		read(keyFlags);
+		n += sizeof(frame) + sizeof(keyFlags);
+		
+		// tension, continuity, bias, ease to and ease from follow if their
+		// bit is set; they are skipped, keys are interpolated linearly
+		DWord splineSize = 0;
+		for (Word bit=0x01; bit<=0x10; bit <<= 1) {
+			if (keyFlags & bit)
+				splineSize += sizeof(GLfloat);
+		}
+		
+		if (n + splineSize + valueSize > length)
+			break;
+		skip(splineSize);
+		n += splineSize + valueSize;
+		
+		bool ordered = (track.numKeys == 0 || frame > previousFrame);
+		if (!ordered)
+			LOG3DS_WARNING(object->name << ": a key of frame " << frame << " is out of order, it is ignored");
+		
+		switch (id) {
+			case chunks::MESHINFO_POSTRACK:
+			case chunks::MESHINFO_SCALETRACK: {
+				VectorKey key;
+				key.frame = frame;
+				read(key.value);
+				
+				if (ordered)
+					(id == chunks::MESHINFO_POSTRACK ? positionKeys : scaleKeys).push_back(key);
+				break;
+			}
+			
+			case chunks::MESHINFO_ROTTRACK: {
+				GLfloat angle;
+				Vector axis;
+				read(angle);
+				read(axis);
+				
+				RotationKey key;
+				key.frame = frame;
+				// the angles of the file turn clockwise
+				key.value = Quaternion::fromAxisAngle(axis, -angle);
+				if (track.numKeys > 0)
+					key.value = key.value * rotationKeys.back().value;
+				
+				if (ordered)
+					rotationKeys.push_back(key);
+				
+				// the first key is absolute
+				if (track.numKeys == 0) {
+					object->rottrackAxis = axis;
+					object->rottrackAngle = angle;
+				}
+				break;
+			}
+		}
+		
+		if (ordered) {
+			previousFrame = frame;
+			++track.numKeys;
+		}
+	}
+	
+	if (n < length)
+		skip(length - n);
+	
+	if (track.numKeys == 0)
+		return;
+	
+	switch (id) {
+		case chunks::MESHINFO_POSTRACK:
+			object->positionTrack = track;
+			object->postrack = positionKeys[track.firstKey].value;
+			LOG3DS_DEBUG("postrack:\t" << track.numKeys << " keys");
+			break;
+		
+		case chunks::MESHINFO_ROTTRACK:
+			object->rotationTrack = track;
+			LOG3DS_DEBUG("rottrack:\t" << track.numKeys << " keys");
+			break;
+		
+		case chunks::MESHINFO_SCALETRACK:
+			object->scaleTrack = track;
+			object->scaletrackX = scaleKeys[track.firstKey].value.x;
+			object->scaletrackY = scaleKeys[track.firstKey].value.y;
+			object->scaletrackZ = scaleKeys[track.firstKey].value.z;
+			LOG3DS_DEBUG("scaletrack:\t" << track.numKeys << " keys");
+			break;
+	}
+}
+
+// Appends parent and child links to the children of the objects, which are
+// stored as one array where each object owns a contiguous range.
+void Model3DS::linkChildren(const vector<pair<DWord, DWord> > &links)
+{
+	if (links.empty())
+		return;
+	
+	vector<pair<DWord, DWord> > all;
+	all.reserve(children.size() + links.size());
+	
+	for (size_t i=0; i<objects.size(); ++i) {
+		for (DWord j=0; j<objects[i].numChildren; ++j)
+			all.push_back(make_pair(static_cast<DWord>(i), children[objects[i].firstChild + j]));
+	}
+	all.insert(all.end(), links.begin(), links.end());
+	
+	for (size_t i=0; i<objects.size(); ++i)
+		objects[i].numChildren = 0;
+	for (size_t i=0; i<all.size(); ++i)
+		++objects[all[i].first].numChildren;
+	
+	DWord first = 0;
+	for (size_t i=0; i<objects.size(); ++i) {
+		objects[i].firstChild = first;
+		first += objects[i].numChildren;
+		objects[i].numChildren = 0;
+	}
+	
+	// stable, so children keep the order of the file
+	children.resize(all.size());
+	for (size_t i=0; i<all.size(); ++i) {
+		Object &parent = objects[all[i].first];
+		children[parent.firstChild + parent.numChildren++] = all[i].second;
+		objects[all[i].second].parent = all[i].first;
+	}
+}
+
+GLuint Model3DS::addTexture(const char *texmapFile)
+{
+	string fileName = string(path) + texmapFile;
+	map<string, GLuint>::const_iterator cached = textureCache.find(fileName);
+	
+	// materials sharing a file share the texture
+	if (cached != textureCache.end())
+		return cached->second;
+	
+	GLuint textureRef = textureFiles.size();
+	textureFiles.push_back(fileName);
+	textureCache[fileName] = textureRef;
+	
+	sharedTextures.push_back(TextureRegistry::instance().acquire(fileName, textureDecoding));
+	
+	return textureRef;
+}
+
 void Model3DS::parseColor(Color &color)
 {
-	cout << "parseColor" << endl;
+	LOG3DS_DEBUG("parseColor");
 	DWord length = currentChunk.length;
 	DWord n = cfg3ds::chunkHeaderSize; 
 	
-	while (n < length)
+	while (n < length && !truncated)
 	{
 		readChunkHeader();
 		n += currentChunk.length;
@@ -751,7 +2157,7 @@ void Model3DS::parseColor(Color &color)
 		{
 			case chunks::COLOR_FLOAT:
 			case chunks::COLOR_FLOATG:
-				fread(&color, sizeof(float), 3, fp);
+				readBytes(&color, 3*sizeof(GLfloat));
 				break;
 			
 			case chunks::COLOR_BYTE:
@@ -772,16 +2178,12 @@ void Model3DS::parseColor(Color &color)
 	}
 }
 
-size_t Model3DS::readString(char *&x)
+size_t Model3DS::readString(StringId &x)
 {
-	long int startPos = ftell(fp);
-	int length = 1;
-	int c;
-	
-	while ((c = fgetc(fp)) != '\0')
-		++length;
+	const char *text;
+	size_t length;
+	size_t n = stream->readString(text, length, stringScratch);
 	
-	fseek(fp, startPos, SEEK_SET);
-	x = new char[length];
-	return fread(x, sizeof(char), length, fp);
+	x = strings.intern(text, length);
+	return n;
 }
@@ -3,22 +3,41 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstddef>
 #include <cstring>
 #include <cmath>
-#include <list>
+#include <vector>
+#include <string>
+#include <map>
 #include <algorithm>
 #include <stdexcept>
 #include <SFML/Graphics.hpp>
 #include <GL/gl.h>
 
 #include "types3ds.h"
+#include "stream3ds.h"
+#include "arena3ds.h"
+#include "strings3ds.h"
+#include "normals3ds.h"
+#include "parallel3ds.h"
+#include "buffers3ds.h"
+#include "mesh3ds.h"
+#include "bvh3ds.h"
+#include "texture3ds.h"
+#include "profile3ds.h"
+#include "log3ds.h"
 
 #include <iostream>
 
+class MappedFile;
+class AnimationSampler;
+
 using namespace std;
 
 namespace cfg3ds {
 	const int chunkHeaderSize = 6;
+	const unsigned int normalThreads = 4; // default of Model3DS::setNormalThreads()
+	const Word largeMeshFaces = 16384; // meshes whose normals are split over threads
 	const GLfloat selectedColor[] = {0.f, 1.f, 1.f, 1.f};
 }
 
@@ -32,6 +51,7 @@ namespace chunks
 					const Word MESH_VERTICES = 0x4110;
 					const Word MESH_FACES = 0x4120;
 						const Word FACES_MATERIALS = 0x4130;
+						const Word FACES_SMOOTHING = 0x4150;
 						
 					const Word MESH_MAPCOORDS = 0x4140;
 					const Word MESH_LOCALCOORDS = 0x4160;
@@ -45,6 +65,7 @@ namespace chunks
 					const Word TEXMAP_FILE = 0xA300;
 		
 		const Word KEYFRAMER = 0xB000;
+			const Word KEYFRAMER_FRAMES = 0xB008;
 			const Word KEYFRAMER_MESHINFO = 0xB002;
 				const Word MESHINFO_HIERARCHY = 0xB010;
 				const Word MESHINFO_PIVOT = 0xB013;
@@ -58,34 +79,47 @@ namespace chunks
 	const Word COLOR_FLOATG = 0x0013;
 }
 
+// Objects live in one array of the model and refer to each other, to their
+// vertex lists and to materials by index into the model's arrays. The mesh
+// arrays live in the model's arena.
 struct Object
 {
-	Object(GLuint *&tex, GLuint sel);
-	~Object();
-	
-	void draw(bool highlighted = false) const;
+	Object(GLuint sel = 0);
 	
-	char *name;
+	const char *name; // owned by the model's StringTable
+	StringId nameId;
 	Vertex *vertices;
 	Vector *normals;
 	Face *faces;
 	MapCoord *mapCoords;
-	Word numVertices, numFaces;
-	list<VertexList *> vertexLists;
+	DWord *smoothingGroups; // a mask per face, NULL if the file has none
+	Word numVertices, numFaces, numMapCoords;
+	// the same vertices and normals as x, y and z arrays, with
+	// Model3DS::setSoALayout(true) only
+	VertexArrays soaVertices, soaNormals;
+	DWord firstVertexList, numVertexLists; // range of Model3DS::getVertexLists()
+	// of the arrays in the model's vertex buffer, in bytes
+	size_t vertexOffset, normalOffset, mapCoordOffset;
+	size_t indexOffset; // of the compiled mesh's indices in the index buffer
+	BoundingBox bounds; // of the vertices, where they were modelled
 	
 	Vector u, v, w, origin;
 	Vector pivot;
 	
+	// the first key of each track
 	Vector postrack;
 	Vector rottrackAxis;
 	GLfloat rottrackAngle;
 	GLfloat scaletrackX, scaletrackY, scaletrackZ;
+	// ranges of Model3DS::getPositionKeys(), getRotationKeys() and
+	// getScaleKeys(), empty for objects outside the keyframer
+	Track positionTrack, rotationTrack, scaleTrack;
 	
 	Vector position;
 	Vector rotation;
 	
-	list<Object *> children;
-	GLuint **textures;
+	DWord parent; // noIndex for roots and objects outside the hierarchy
+	DWord firstChild, numChildren; // range of Model3DS::getChildren()
 	
 	GLuint selectName;
 	bool selected;
@@ -96,14 +130,174 @@ class Model3DS
 	public:
 		Model3DS(GLuint sel = 0);
 		~Model3DS();
+		
+		// Parsing builds the whole scene on the CPU and does not need a GL
+		// context, so it can run headless or on a worker thread.
+		bool parse(const char *fileName);
+		bool parse(const void *data, size_t size, const char *texturePath = "");
+		bool parse(Stream3DS &source, const char *texturePath = "");
+		// Creates the GL textures of a parsed model, or shares the ones already
+		// created by other models, and the buffer objects if enabled. Needs a
+		// current GL context.
+		void upload();
+		// Whether upload() copies the meshes to a vertex and an index buffer
+		// object that draw() binds, instead of drawing from client memory
+		// every frame. Off by default; ignored without GL 1.5 or
+		// ARB_vertex_buffer_object.
+		void setBufferObjects(bool enabled) { bufferObjects = enabled; }
+		
+		// Builds a CompiledMesh of each object, which draw() and the buffer
+		// objects then use instead of the separate arrays. Call it after
+		// parse() and before upload().
+		void compile();
+		// the meshes of compile(), indexed like getObjects()
+		const vector<CompiledMesh> &getCompiledMeshes() const { return compiledMeshes; }
+		// Merges objects into one mesh with a range per material, as they are
+		// in the file, i.e. without their keyframer transformations. Equal
+		// vertices of different objects are stored once.
+		void merge(const vector<DWord> &objectIndices, CompiledMesh &mesh) const;
+		// Reorders the triangles of the compiled meshes for the vertex cache
+		// and then their vertices for fetching, compiling them first if
+		// needed. Returns the ACMR of all the meshes before and after.
+		void optimize(float *acmrBefore = NULL, float *acmrAfter = NULL);
+		// Whether textures are decoded on worker threads while parsing, which is
+		// the default. Otherwise they are decoded by upload(), e.g. when models
+		// are only parsed to be inspected.
+		void setTextureDecoding(bool enabled) { textureDecoding = enabled; }
+		// Whether objects also keep their vertices and normals as separate
+		// x, y and z arrays, for SIMD processing on the CPU. Off by default.
+		void setSoALayout(bool enabled) { soaLayout = enabled; }
+		// Whether parse() and parseBaked() also build a MeshBVH of each
+		// object, which pick() then searches. Off by default.
+		void setBVHs(bool enabled) { bvhEnabled = enabled; }
+		// Builds the BVHs of the objects without one, spread over the
+		// normal threads, e.g. after parsing without them.
+		void buildBVHs();
+		// in the space of each object's mesh, see getMeshMatrices(); empty
+		// for objects without (valid) faces or until built
+		const vector<MeshBVH> &getBVHs() const { return bvhs; }
+		
+		// The normals are built once all the chunks are read. Without them
+		// (skipNormals) Object::normals stays NULL.
+		enum NormalMode { skipNormals, areaWeightedNormals, angleWeightedNormals };
+		void setNormalMode(NormalMode mode) { normalMode = mode; }
+		// Whether the smoothing groups of the file are honoured, which is
+		// the default. Vertices shared by faces of different groups are
+		// then duplicated, so numVertices can grow.
+		void setSmoothingGroups(bool enabled) { smoothing = enabled; }
+		// Threads building the normals, including the calling one. Small
+		// objects are spread over them and large ones split by face ranges.
+		void setNormalThreads(unsigned int numThreads) { normalThreads = numThreads; }
+		
+		// parse() followed by upload()
 		bool load(const char *fileName);
+		bool load(const void *data, size_t size, const char *texturePath = "");
+		bool load(Stream3DS &source, const char *texturePath = "");
+		
+		// Writes the parsed model, its normals and its compiled meshes to a
+		// file that parseBaked() maps and uses almost as is, compiling the
+		// meshes first if needed. Baked files only suit the machine type
+		// that wrote them.
+		bool bake(const char *fileName);
+		// Reads a file written by bake() into an empty model. Returns false
+		// if it is missing or of another version, and throws if it is
+		// corrupt. Textures are looked up relative to fileName.
+		bool parseBaked(const char *fileName);
+		// Reads bakedFileName if it is newer than fileName, otherwise parses
+		// fileName and bakes it to bakedFileName for the next time.
+		bool parseCached(const char *fileName, const char *bakedFileName);
+		
+		// Collects LoadStats in the following parse() and upload() calls, when
+		// built with OPEN3DS_PROFILE. getStats() returns NULL until enabled.
+		void setProfiling(bool enabled);
+		const LoadStats *getStats() const { return stats; }
+		
+		const vector<Object> &getObjects() const { return objects; }
+		const vector<Material> &getMaterials() const { return materials; }
+		const vector<VertexList> &getVertexLists() const { return vertexLists; }
+		// indices of the top level objects of the hierarchy
+		const vector<DWord> &getRoots() const { return roots; }
+		// indices of the children of all objects, see Object::firstChild
+		const vector<DWord> &getChildren() const { return children; }
+		// keys of all the tracks, see Object::positionTrack
+		const vector<VectorKey> &getPositionKeys() const { return positionKeys; }
+		const vector<RotationKey> &getRotationKeys() const { return rotationKeys; }
+		const vector<VectorKey> &getScaleKeys() const { return scaleKeys; }
+		// the animation's frames as set in the file
+		DWord getFirstFrame() const { return firstFrame; }
+		DWord getLastFrame() const { return lastFrame; }
+		// texture files with the texture path prepended, indexed by Material::textureRef
+		const vector<string> &getTextureFiles() const { return textureFiles; }
+		// names of the objects and materials and texture files
+		const StringTable &getStrings() const { return strings; }
+		
+		// Samples the tracks of all the objects at frame, which draw() then
+		// uses instead of the static mesh placement, see AnimationSampler.
+		void animate(GLfloat frame);
+		// the poses of the last animate(), indexed like getObjects()
+		const vector<Pose> &getPoses() const { return poses; }
+		
+		// Each object's transformation to the model's space, which its
+		// children inherit, and the one of its mesh, indexed like
+		// getObjects(). They are cached and only the objects moved by
+		// rotateSelected(), translateSelected() or animate() since the last
+		// call and their descendants are updated.
+		const vector<Matrix> &getWorldMatrices() const;
+		const vector<Matrix> &getMeshMatrices() const;
+		// Bounds in the model's space of each object's mesh and of the object
+		// with all its descendants, kept with the matrices, and of the whole
+		// model.
+		const vector<BoundingBox> &getMeshBounds() const;
+		const vector<BoundingBox> &getSubtreeBounds() const;
+		BoundingBox getBounds() const;
+		// Whether draw() skips the objects and whole subtrees outside the
+		// view frustum of the current projection and modelview matrices,
+		// which is the default.
+		void setCulling(bool enabled) { culling = enabled; }
+		
+		// Casts a ray, origin + t*direction for t >= 0 in the space the model
+		// is drawn in, against the meshes as draw() places them. Returns
+		// false if it misses them all, otherwise hit is the closest triangle.
+		// The boxes of the subtrees and meshes are tested first, so only
+		// the meshes along the ray are searched, with their BVHs if built.
+		bool pick(const Vector &origin, const Vector &direction, RayHit &hit) const;
+		
 		void draw() const;
 		void select(GLint selectedName);
 		void rotateSelected(GLfloat delta, Axis axis);
 		void translateSelected(GLfloat delta, Axis axis);
 	
 	protected:
-		void parse();
+		// state of the object hierarchy being rebuilt from the keyframer chunk
+		struct Hierarchy
+		{
+			Hierarchy(): previousLevel(0), rootLevel(-1), previousObject(noIndex), currentParent(noIndex), dummyName(noStringId) {}
+			
+			short int previousLevel, rootLevel;
+			DWord previousObject, currentParent;
+			vector<DWord> parents;
+			StringId dummyName; // placeholder nodes that never become roots
+			vector<pair<DWord, DWord> > links; // parent and child, in file order
+		};
+		
+		void drawObject(DWord index, bool highlighted, const Frustum *frustum) const;
+			void drawAxes() const;
+			void drawMesh(const Object &object, size_t index, bool highlight) const;
+		void drawCompiled(const Object &object, const CompiledMesh &mesh, bool highlighted) const;
+		void applyMaterial(DWord index, bool highlighted) const;
+		void compileObjects(MeshCompiler &compiler, const DWord *objectIndices, size_t numObjects, CompiledMesh &mesh) const;
+		void uploadBuffers();
+		
+		void updateTransforms() const;
+			bool updateTransform(DWord index, const Matrix &parentWorld, bool parentChanged) const;
+		Matrix getNodeMatrix(DWord index) const;
+		Matrix getPivotMatrix(DWord index) const;
+		void invalidateTransforms();
+		void invalidateTransform(DWord index);
+		void pickObject(DWord index, const Vector &origin, const Vector &direction, const Vector &inverseDirection, RayHit &hit) const;
+		
+		bool parseFrom(Stream3DS &source);
+		bool parseRoot();
 			void parseMain();
 				void parseEdit();
 					void parseObject();
@@ -114,42 +308,144 @@ class Model3DS
 						void parseTexmap(Material *material);
 				
 				void parseKeyframer();
-					void parseMeshinfo();
+					void parseMeshinfo(Hierarchy &state);
+						void parseTrack(Object *object);
+					void linkChildren(const vector<pair<DWord, DWord> > &links);
 			void parseColor(Color &color);
+			GLuint addTexture(const char *texmapFile);
+		
+		// the normals and vertex lists of the objects parsed since the last call
+		void finishMeshes();
+			void finishObject(Object &object, normals3ds::MeshNormals &meshNormals, unsigned int numThreads);
+			void expandVertexLists(const Object &object);
+			void deinterleave(Object &object);
 		
-		size_t readChunkHeader() { return (read(currentChunk.id) + read(currentChunk.length)); }
+		bool readBaked(const char *fileName);
+		void readBaked(const void *data, size_t size);
+		static void finishObjects(void *context, size_t begin, size_t end);
+		static void buildObjectBVHs(void *context, size_t begin, size_t end);
+		
+		size_t readChunkHeader()
+		{
+			size_t n = read(currentChunk.id) + read(currentChunk.length);
+			// a truncated or corrupt header must still make progress, and
+			// the chunks claiming more data than is left end with it
+			if (n != cfg3ds::chunkHeaderSize) {
+				currentChunk.id = 0;
+				currentChunk.length = cfg3ds::chunkHeaderSize;
+				truncated = true;
+			} else if (currentChunk.length < static_cast<DWord>(cfg3ds::chunkHeaderSize))
+				currentChunk.length = cfg3ds::chunkHeaderSize;
+			return n;
+		}
 		void skipChunk() {
-			cout << "skip: " << hex << currentChunk.id << dec << endl;
-			fseek(fp, currentChunk.length - cfg3ds::chunkHeaderSize, SEEK_CUR);
+			LOG3DS_DEBUG("skip: " << hex << currentChunk.id);
+			PROFILE3DS_ADD(stats, LoadStats::skipped, 0.0, currentChunk.length);
+			skip(currentChunk.length - cfg3ds::chunkHeaderSize);
 		}
 		
-		size_t read(Byte &x) { return (fread(&x, sizeof(x), 1, fp) == 1 ? sizeof(x) : 0); }
-		size_t read(Word &x) { return (fread(&x, sizeof(x), 1, fp) == 1 ? sizeof(x) : 0); }
-		size_t read(DWord &x) { return (fread(&x, sizeof(x), 1, fp) == 1 ? sizeof(x) : 0); }
-		size_t read(GLfloat &x) { return (fread(&x, sizeof(x), 1, fp) == 1 ? sizeof(x) : 0); }
-		size_t read(Vector &x) { return (fread(&x, sizeof(x), 1, fp) == 1 ? sizeof(x) : 0); }
-		size_t readString(char *&x);
+		size_t readBytes(void *x, size_t size) { return stream->read(x, size); }
+		void skip(size_t size) { stream->skip(size); }
+		
+		size_t read(Byte &x) { return readBytes(&x, sizeof(x)); }
+		size_t read(Word &x) { return readBytes(&x, sizeof(x)); }
+		size_t read(DWord &x) { return readBytes(&x, sizeof(x)); }
+		size_t read(GLfloat &x) { return readBytes(&x, sizeof(x)); }
+		size_t read(Vector &x) { return readBytes(&x, sizeof(x)); }
+		size_t readString(StringId &x);
+		
+		template <typename T>
+		T *allocate(size_t n)
+		{
+			// finishMeshes() allocates from several threads
+			sf::Lock lock(arenaMutex);
+			return arena.allocate<T>(n);
+		}
+		
+		// name-keyed indices, the ids of the string table are dense so a
+		// vector indexed by StringId is the hash index
+		static void addByName(vector<DWord> &index, StringId id, DWord x)
+		{
+			if (id == noStringId)
+				return;
+			if (id >= index.size())
+				index.resize(id+1, noIndex);
+			// the first of several equally named entries wins, like a list scan
+			if (index[id] == noIndex)
+				index[id] = x;
+		}
+		static DWord findByName(const vector<DWord> &index, StringId id)
+		{
+			return id < index.size() ? index[id] : noIndex;
+		}
+		
+		VertexArrays allocateArrays(size_t n)
+		{
+			VertexArrays arrays;
+			arrays.x = allocate<GLfloat>(n);
+			arrays.y = allocate<GLfloat>(n);
+			arrays.z = allocate<GLfloat>(n);
+			return arrays;
+		}
+		
+		void setPath(const char *texturePath, size_t length);
+		void setPathOf(const char *fileName);
 		
-		FILE *fp;
 		char *path;
+		Arena3DS arena; // mesh arrays and strings, freed with the model
+		sf::Mutex arenaMutex;
+		StringTable strings;
+		string stringScratch;
+		Stream3DS *stream; // source of the model being loaded
 		ChunkHeader currentChunk; // currently parsed chunk header
+		bool truncated; // the stream ended within a chunk
+		
+		vector<Object> objects;
+		vector<Material> materials;
+		vector<VertexList> vertexLists;
+		vector<DWord> objectsByName, materialsByName;
+		vector<CompiledMesh> compiledMeshes;
+		vector<MeshBVH> bvhs;
+		vector<string> textureFiles;
+		vector<SharedTexture *> sharedTextures; // registry entries of textureFiles
+		map<string, GLuint> textureCache; // textureRef of each file in textureFiles
+		bool textureDecoding;
+		bool soaLayout;
+		bool bvhEnabled;
+		bool bufferObjects;
+		NormalMode normalMode;
+		bool smoothing;
+		unsigned int normalThreads;
+		size_t numFinishedObjects;
+		
+		LoadStats *stats;
 		
-		short int previousLevel, rootLevel;
-		Object *previousObject, *currentParent;
-		vector<Object *> parents;
+		vector<DWord> roots;
+		vector<DWord> children;
 		
-		list<Object *> objects;
-		list<Material *> materials;
+		vector<VectorKey> positionKeys, scaleKeys;
+		vector<RotationKey> rotationKeys;
+		DWord firstFrame, lastFrame;
+		vector<Pose> poses;
+		AnimationSampler *sampler; // of animate()
 		
-		list<Object *> roots;
+		// filled by updateTransforms() when the objects are drawn or the
+		// matrices asked for
+		mutable vector<Matrix> localMatrices, worldMatrices, meshMatrices;
+		mutable vector<BoundingBox> meshBounds, subtreeBounds;
+		mutable vector<bool> dirtyObjects; // whose local matrix is out of date
+		mutable bool transformsDirty;
+		bool culling;
 		
 		GLuint *textures;
 		GLuint numTextures;
+		GLuint vertexBuffer, indexBuffer; // 0 unless uploaded
+		MappedFile *bakedFile; // holds the mesh arrays of parseBaked()
 
 		GLuint selectName;		
 		GLuint currentSelectName;
 		
-		Object *selectedObject;
+		DWord selectedObject;
 };
 
 #endif // _3DS_H_
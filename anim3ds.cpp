@@ -0,0 +1,218 @@
+#include "anim3ds.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	// coefficients of Eberly's slerp, "A Fast and Accurate Algorithm for
+	// Computing SLERP", with the last term corrected by 1 + mu
+	const GLfloat onePlusMu = 1.90110745351730037f;
+	const int numTerms = 8;
+	const GLfloat u[numTerms] = {
+		1.f/(1*3), 1.f/(2*5), 1.f/(3*7), 1.f/(4*9), 1.f/(5*11), 1.f/(6*13), 1.f/(7*15), onePlusMu/(8*17)
+	};
+	const GLfloat v[numTerms] = {
+		1.f/3, 2.f/5, 3.f/7, 4.f/9, 5.f/11, 6.f/13, 7.f/15, onePlusMu*8/17
+	};
+
+	template <typename Key>
+	bool isBefore(GLfloat frame, const Key &key)
+	{
+		return frame < key.frame;
+	}
+}
+
+void anim3ds::lerp(size_t n, const GLfloat *weights, GLfloat *const from[3], const GLfloat *const to[3])
+{
+	for (int c=0; c<3; ++c) {
+		GLfloat *a = from[c];
+		const GLfloat *b = to[c];
+
+		for (size_t i=0; i<n; ++i)
+			a[i] += (b[i] - a[i])*weights[i];
+	}
+}
+
+void anim3ds::slerp(size_t n, const GLfloat *weights, GLfloat *const from[4], const GLfloat *const to[4])
+{
+	GLfloat *x0 = from[0], *y0 = from[1], *z0 = from[2], *w0 = from[3];
+	const GLfloat *x1 = to[0], *y1 = to[1], *z1 = to[2], *w1 = to[3];
+
+	for (size_t i=0; i<n; ++i) {
+		GLfloat cosine = x0[i]*x1[i] + y0[i]*y1[i] + z0[i]*z1[i] + w0[i]*w1[i];
+		// the shorter arc
+		GLfloat sign = (cosine >= 0.f ? 1.f : -1.f);
+		GLfloat cosineMinusOne = cosine*sign - 1.f;
+
+		GLfloat t = weights[i], d = 1.f - t;
+		GLfloat tt = t*t, dd = d*d;
+		GLfloat cT = 1.f, cD = 1.f;
+
+		for (int k=numTerms-1; k>=0; --k) {
+			cT = 1.f + (u[k]*tt - v[k])*cosineMinusOne*cT;
+			cD = 1.f + (u[k]*dd - v[k])*cosineMinusOne*cD;
+		}
+		cT *= t*sign;
+		cD *= d;
+
+		x0[i] = x0[i]*cD + x1[i]*cT;
+		y0[i] = y0[i]*cD + y1[i]*cT;
+		z0[i] = z0[i]*cD + z1[i]*cT;
+		w0[i] = w0[i]*cD + w1[i]*cT;
+	}
+}
+
+void anim3ds::toMatrix(const Quaternion &q, GLfloat m[16])
+{
+	GLfloat xx = q.x*q.x, yy = q.y*q.y, zz = q.z*q.z;
+	GLfloat xy = q.x*q.y, xz = q.x*q.z, yz = q.y*q.z;
+	GLfloat wx = q.w*q.x, wy = q.w*q.y, wz = q.w*q.z;
+
+	m[0] = 1.f - 2.f*(yy + zz);
+	m[1] = 2.f*(xy + wz);
+	m[2] = 2.f*(xz - wy);
+	m[3] = 0.f;
+
+	m[4] = 2.f*(xy - wz);
+	m[5] = 1.f - 2.f*(xx + zz);
+	m[6] = 2.f*(yz + wx);
+	m[7] = 0.f;
+
+	m[8] = 2.f*(xz + wy);
+	m[9] = 2.f*(yz - wx);
+	m[10] = 1.f - 2.f*(xx + yy);
+	m[11] = 0.f;
+
+	m[12] = m[13] = m[14] = 0.f;
+	m[15] = 1.f;
+}
+
+AnimationSampler::AnimationSampler(const Model3DS &model):
+	model(model),
+	cursors(3*model.getObjects().size(), 0),
+	positionWeights(model.getObjects().size()),
+	rotationWeights(model.getObjects().size()),
+	scaleWeights(model.getObjects().size())
+{
+	for (int c=0; c<numComponents; ++c) {
+		from[c].resize(model.getObjects().size());
+		to[c].resize(model.getObjects().size());
+	}
+}
+
+// Returns the weight of to, from and to are NULL if the track has no keys.
+template <typename Key>
+GLfloat AnimationSampler::seek(const vector<Key> &keys, const Track &track, GLfloat frame, DWord &cursor, const Key *&from, const Key *&to)
+{
+	if (track.numKeys == 0) {
+		from = to = NULL;
+		return 0.f;
+	}
+
+	const Key *first = &keys[track.firstKey];
+	const Key *last = first + track.numKeys - 1;
+
+	if ((track.flags & Track::loop) != 0 && last->frame > first->frame) {
+		GLfloat length = last->frame - first->frame;
+		frame = first->frame + fmod(frame - first->frame, length);
+		if (frame < first->frame)
+			frame += length;
+	}
+
+	// also for NaN
+	if (!(frame > first->frame)) {
+		from = to = first;
+		cursor = 0;
+		return 0.f;
+	}
+	if (frame >= last->frame) {
+		from = to = last;
+		cursor = track.numKeys - 1;
+		return 0.f;
+	}
+
+	// the segment of the last sample, the one after it or a search
+	DWord i = cursor;
+	if (i + 1 >= track.numKeys || !(first[i].frame <= frame && frame < first[i+1].frame)) {
+		if (i + 2 < track.numKeys && first[i+1].frame <= frame && frame < first[i+2].frame)
+			++i;
+		else
+			i = upper_bound(first, last, frame, isBefore<Key>) - first - 1;
+	}
+	cursor = i;
+
+	from = first + i;
+	to = from + 1;
+	return (frame - from->frame) / (to->frame - from->frame);
+}
+
+void AnimationSampler::setVector(Component first, size_t i, const Vector &a, const Vector &b)
+{
+	from[first][i] = a.x;
+	from[first+1][i] = a.y;
+	from[first+2][i] = a.z;
+	to[first][i] = b.x;
+	to[first+1][i] = b.y;
+	to[first+2][i] = b.z;
+}
+
+void AnimationSampler::sample(GLfloat frame, Pose *poses)
+{
+	const vector<Object> &objects = model.getObjects();
+	size_t n = min(objects.size(), positionWeights.size());
+	if (n == 0)
+		return;
+
+	for (size_t i=0; i<n; ++i) {
+		const Object &object = objects[i];
+		const VectorKey *a, *b;
+		const RotationKey *c, *d;
+
+		positionWeights[i] = seek(model.getPositionKeys(), object.positionTrack, frame, cursors[3*i], a, b);
+		if (a != NULL)
+			setVector(positionX, i, a->value, b->value);
+		else
+			setVector(positionX, i, Vector(), Vector());
+
+		rotationWeights[i] = seek(model.getRotationKeys(), object.rotationTrack, frame, cursors[3*i + 1], c, d);
+		Quaternion q0, q1;
+		if (c != NULL) {
+			q0 = c->value;
+			q1 = d->value;
+		}
+		from[rotationX][i] = q0.x;
+		from[rotationY][i] = q0.y;
+		from[rotationZ][i] = q0.z;
+		from[rotationW][i] = q0.w;
+		to[rotationX][i] = q1.x;
+		to[rotationY][i] = q1.y;
+		to[rotationZ][i] = q1.z;
+		to[rotationW][i] = q1.w;
+
+		scaleWeights[i] = seek(model.getScaleKeys(), object.scaleTrack, frame, cursors[3*i + 2], a, b);
+		if (a != NULL)
+			setVector(scaleX, i, a->value, b->value);
+		else
+			setVector(scaleX, i, Vector(1.f, 1.f, 1.f), Vector(1.f, 1.f, 1.f));
+	}
+
+	GLfloat *positionFrom[] = {&from[positionX][0], &from[positionY][0], &from[positionZ][0]};
+	const GLfloat *positionTo[] = {&to[positionX][0], &to[positionY][0], &to[positionZ][0]};
+	anim3ds::lerp(n, &positionWeights[0], positionFrom, positionTo);
+
+	GLfloat *rotationFrom[] = {&from[rotationX][0], &from[rotationY][0], &from[rotationZ][0], &from[rotationW][0]};
+	const GLfloat *rotationTo[] = {&to[rotationX][0], &to[rotationY][0], &to[rotationZ][0], &to[rotationW][0]};
+	anim3ds::slerp(n, &rotationWeights[0], rotationFrom, rotationTo);
+
+	GLfloat *scaleFrom[] = {&from[scaleX][0], &from[scaleY][0], &from[scaleZ][0]};
+	const GLfloat *scaleTo[] = {&to[scaleX][0], &to[scaleY][0], &to[scaleZ][0]};
+	anim3ds::lerp(n, &scaleWeights[0], scaleFrom, scaleTo);
+
+	for (size_t i=0; i<n; ++i) {
+		Pose &pose = poses[i];
+		pose.position = Vector(from[positionX][i], from[positionY][i], from[positionZ][i]);
+		pose.rotation = Quaternion(from[rotationX][i], from[rotationY][i], from[rotationZ][i], from[rotationW][i]);
+		pose.scale = Vector(from[scaleX][i], from[scaleY][i], from[scaleZ][i]);
+	}
+}
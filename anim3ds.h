@@ -0,0 +1,62 @@
+#ifndef _ANIM3DS_H_
+#define _ANIM3DS_H_
+
+#include <cstdlib>
+#include <vector>
+#include <GL/gl.h>
+
+#include "3ds.h"
+
+using namespace std;
+
+// Kernels interpolating many keys at once. The values are separate arrays
+// per component, so the loops have no branches and vectorize.
+namespace anim3ds
+{
+	// from[c][i] becomes from[c][i] + (to[c][i] - from[c][i])*weights[i],
+	// for the x, y and z arrays
+	void lerp(size_t n, const GLfloat *weights, GLfloat *const from[3], const GLfloat *const to[3]);
+	// The same for the x, y, z and w arrays of unit quaternions, along the
+	// shorter arc. Uses Eberly's polynomial approximation, which needs no
+	// trigonometry and stays within 1e-4 of the exact slerp.
+	void slerp(size_t n, const GLfloat *weights, GLfloat *const from[4], const GLfloat *const to[4]);
+
+	// column-major, like glMultMatrixf() takes it
+	void toMatrix(const Quaternion &q, GLfloat m[16]);
+}
+
+// Samples the tracks of all the objects of a model. Each track keeps the key
+// it was last sampled at, so playing forward costs a step per track and
+// other jumps a binary search, and the buffers are allocated once, so
+// sample() never allocates. Use a sampler per thread or per instance at its
+// own frame; the model is only read.
+class AnimationSampler
+{
+	public:
+		AnimationSampler(const Model3DS &model);
+
+		// The pose of each object at frame, indexed like getObjects(). Objects
+		// without keys get the identity pose.
+		void sample(GLfloat frame, Pose *poses);
+
+	private:
+		enum Component
+		{
+			positionX, positionY, positionZ,
+			rotationX, rotationY, rotationZ, rotationW,
+			scaleX, scaleY, scaleZ,
+			numComponents
+		};
+
+		template <typename Key>
+		static GLfloat seek(const vector<Key> &keys, const Track &track, GLfloat frame, DWord &cursor, const Key *&from, const Key *&to);
+
+		void setVector(Component first, size_t i, const Vector &from, const Vector &to);
+
+		const Model3DS &model;
+		vector<DWord> cursors; // position, rotation and scale key of each object
+		vector<GLfloat> from[numComponents], to[numComponents];
+		vector<GLfloat> positionWeights, rotationWeights, scaleWeights;
+};
+
+#endif // _ANIM3DS_H_
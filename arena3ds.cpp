@@ -0,0 +1,72 @@
+#include "arena3ds.h"
+
+#include <algorithm>
+
+namespace
+{
+	const size_t maxBlockSize = 16*1024*1024;
+}
+
+const size_t Arena3DS::defaultAlignment;
+
+Arena3DS::Arena3DS(size_t blockSize):
+	cursor(NULL),
+	end(NULL),
+	blockSize(blockSize),
+	nextBlockSize(blockSize),
+	capacity(0),
+	stats(NULL)
+{}
+
+Arena3DS::~Arena3DS()
+{
+	release();
+}
+
+void *Arena3DS::allocate(size_t size, size_t alignment)
+{
+	// alignment is a power of two
+	size_t padding = (alignment - reinterpret_cast<size_t>(cursor)) & (alignment - 1);
+	
+	if (cursor == NULL || static_cast<size_t>(end - cursor) < padding + size) {
+		addBlock(size + alignment);
+		padding = (alignment - reinterpret_cast<size_t>(cursor)) & (alignment - 1);
+	}
+	
+	char *p = cursor + padding;
+	cursor = p + size;
+	
+	return p;
+}
+
+void Arena3DS::reserve(size_t size)
+{
+	if (cursor == NULL || static_cast<size_t>(end - cursor) < size)
+		nextBlockSize = max(nextBlockSize, size);
+}
+
+void Arena3DS::release()
+{
+	for (size_t i=0; i<blocks.size(); ++i)
+		delete [] blocks[i];
+	
+	blocks.clear();
+	cursor = end = NULL;
+	nextBlockSize = blockSize;
+	capacity = 0;
+}
+
+void Arena3DS::addBlock(size_t size)
+{
+	size = max(size, nextBlockSize);
+	
+	blocks.push_back(new char[size]);
+	cursor = blocks.back();
+	end = cursor + size;
+	capacity += size;
+	
+	// blocks grow with the model so big models need few of them
+	nextBlockSize = min(max(nextBlockSize, capacity), maxBlockSize);
+	
+	PROFILE3DS_ALLOC(stats, size);
+}
@@ -0,0 +1,50 @@
+#ifndef _ARENA3DS_H_
+#define _ARENA3DS_H_
+
+#include <cstdlib>
+#include <vector>
+
+#include "profile3ds.h"
+
+using namespace std;
+
+// Monotonic allocator holding all the arrays and strings of a model. Memory
+// is handed out from a few large blocks and only given back all at once, by
+// release() or the destructor. Allocations are not constructed, so it is
+// meant for plain data that is filled right away.
+class Arena3DS
+{
+	public:
+		static const size_t defaultAlignment = 16; // enough for SSE loads
+		
+		Arena3DS(size_t blockSize = 64*1024);
+		~Arena3DS();
+		
+		void *allocate(size_t size, size_t alignment = defaultAlignment);
+		template <typename T>
+		T *allocate(size_t n) { return static_cast<T *>(allocate(n*sizeof(T))); }
+		
+		// The next block has room for at least size bytes, e.g. the size of
+		// the file about to be parsed.
+		void reserve(size_t size);
+		void release();
+		
+		size_t getNumBlocks() const { return blocks.size(); }
+		size_t getCapacity() const { return capacity; }
+		
+		// counts the blocks in stats->allocations when profiling
+		void setStats(LoadStats *stats) { this->stats = stats; }
+	
+	private:
+		Arena3DS(const Arena3DS &);
+		Arena3DS &operator =(const Arena3DS &);
+		
+		void addBlock(size_t size);
+		
+		vector<char *> blocks;
+		char *cursor, *end;
+		size_t blockSize, nextBlockSize, capacity;
+		LoadStats *stats;
+};
+
+#endif // _ARENA3DS_H_
@@ -0,0 +1,66 @@
+#include "bake3ds.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace bake3ds
+{
+	DWord Writer::add(const void *x, size_t size)
+	{
+		if (size == 0)
+			return none;
+		
+		size_t offset = (data.size() + alignment - 1) & ~(alignment - 1);
+		data.resize(offset + size, 0);
+		if (x != NULL)
+			memcpy(&data[offset], x, size);
+		
+		return offset;
+	}
+	
+	DWord Writer::addString(const char *s)
+	{
+		if (s == NULL)
+			return none;
+		
+		// strings aren't aligned
+		size_t offset = data.size();
+		data.insert(data.end(), s, s + strlen(s) + 1);
+		
+		return offset;
+	}
+	
+	const char *Reader::getString(DWord offset) const
+	{
+		if (offset == none)
+			return NULL;
+		if (offset >= size || memchr(data + offset, '\0', size - offset) == NULL)
+			throw runtime_error("Baked string exceeds the end of data!");
+		
+		return reinterpret_cast<const char *>(data + offset);
+	}
+	
+	const void *Reader::check(DWord offset, size_t length) const
+	{
+		if (offset == none)
+			return NULL;
+		if (offset > size || length > size - offset)
+			throw runtime_error("Baked array exceeds the end of data!");
+		if (offset % alignment != 0)
+			throw runtime_error("Baked array is misaligned!");
+		
+		return data + offset;
+	}
+	
+	bool isNewer(const char *fileName, const char *otherFileName)
+	{
+		struct stat file, otherFile;
+		
+		if (stat(fileName, &file) != 0 || stat(otherFileName, &otherFile) != 0)
+			return false;
+		
+		return file.st_mtime > otherFile.st_mtime;
+	}
+}
@@ -0,0 +1,135 @@
+#ifndef _BAKE3DS_H_
+#define _BAKE3DS_H_
+
+#include <cstdlib>
+#include <vector>
+#include <GL/gl.h>
+
+#include "types3ds.h"
+
+using namespace std;
+
+// Layout of the files written by Model3DS::bake(). Every reference is an
+// offset from the start of the file, so it can be mapped anywhere and used
+// in place. Sections are 16 byte aligned and numbers are stored in the
+// byte order of the machine that baked the file; the header tells them
+// apart. Any change of the layout has to bump version.
+namespace bake3ds
+{
+	const char magic[8] = {'O', '3', 'D', 'S', 'B', 'A', 'K', 'E'};
+	const DWord version = 3;
+	const DWord byteOrder = 0x01020304;
+	const size_t alignment = 16;
+	
+	// an offset to nothing, e.g. an object without normals
+	const DWord none = 0xFFFFFFFF;
+	
+	struct Header
+	{
+		char magic[8];
+		DWord version, byteOrder;
+		DWord size; // of the whole file
+		
+		DWord numObjects, objects; // Object
+		DWord numMaterials, materials; // Material
+		DWord numVertexLists, vertexLists; // VertexList
+		DWord numRoots, roots; // DWord
+		DWord numChildren, children; // DWord
+		DWord meshes; // a Mesh per object
+		DWord numPositionKeys, positionKeys; // VectorKey
+		DWord numRotationKeys, rotationKeys; // RotationKey
+		DWord numScaleKeys, scaleKeys; // VectorKey
+		DWord firstFrame, lastFrame;
+	};
+	
+	// The arrays are offsets, and indices refer to the other tables.
+	struct Object
+	{
+		DWord name;
+		DWord vertices, normals, faces, mapCoords;
+		Word numVertices, numFaces, numMapCoords, padding;
+		DWord firstVertexList, numVertexLists;
+		
+		Vector u, v, w, origin;
+		Vector pivot;
+		Vector postrack;
+		Vector rottrackAxis;
+		GLfloat rottrackAngle;
+		GLfloat scaletrackX, scaletrackY, scaletrackZ;
+		Track positionTrack, rotationTrack, scaleTrack;
+		Vector position;
+		Vector rotation;
+		BoundingBox bounds;
+		
+		DWord parent;
+		DWord firstChild, numChildren;
+	};
+	
+	// the texture is looked up again from texmapFile, relative to the model
+	struct Material
+	{
+		DWord name, texmapFile;
+		Color ambient, diffuse, specular;
+	};
+	
+	struct VertexList
+	{
+		DWord material;
+		DWord verticesRefs, numVerticesRefs;
+	};
+	
+	// a CompiledMesh
+	struct Mesh
+	{
+		DWord vertices, numVertices; // CompiledVertex
+		DWord indices, numIndices, indexSize;
+		DWord ranges, numRanges; // CompiledMesh::Range
+		DWord hasNormals, hasMapCoords;
+	};
+	
+	// Appends sections to a file image.
+	class Writer
+	{
+		public:
+			Writer(vector<Byte> &data): data(data) {}
+			
+			// Returns the offset of the copy, or none if size is 0. x may be
+			// NULL to leave room for records written later with at().
+			DWord add(const void *x, size_t size);
+			DWord addString(const char *s);
+			// reserves room for n records of type T
+			template <typename T>
+			DWord reserve(size_t n) { return add(NULL, sizeof(T)*n); }
+			template <typename T>
+			T *at(DWord offset) { return reinterpret_cast<T *>(&data[offset]); }
+		
+		private:
+			vector<Byte> &data;
+	};
+	
+	// Checks offsets read from a file image before they are used.
+	class Reader
+	{
+		public:
+			Reader(const void *data, size_t size): data(static_cast<const Byte *>(data)), size(size) {}
+			
+			// NULL for none, throws if the n records don't fit in the file or
+			// are misaligned
+			template <typename T>
+			const T *get(DWord offset, size_t n) const { return static_cast<const T *>(check(offset, sizeof(T)*n)); }
+			// NULL for none, throws unless the string ends within the file
+			const char *getString(DWord offset) const;
+		
+		private:
+			const void *check(DWord offset, size_t size) const;
+			
+			const Byte *data;
+			size_t size;
+	};
+	
+	// Whether fileName was modified after otherFileName, false if either
+	// doesn't exist.
+	bool isNewer(const char *fileName, const char *otherFileName);
+}
+
+#endif // _BAKE3DS_H_
@@ -0,0 +1,131 @@
+#include "batch3ds.h"
+
+ModelBatchLoader::ModelBatchLoader(unsigned int numThreads):
+	numThreads(numThreads > 0 ? numThreads : 1),
+	nextJob(0),
+	numFinished(0)
+{}
+
+ModelBatchLoader::~ModelBatchLoader()
+{
+	// the files not started yet are dropped
+	{
+		sf::Lock lock(mutex);
+		nextJob = jobs.size();
+	}
+
+	for (size_t i=0; i<threads.size(); ++i) {
+		threads[i]->Wait();
+		delete threads[i];
+	}
+
+	// the models parsed but not handed out by update() yet
+	for (size_t i=0; i<jobs.size(); ++i) {
+		if (!jobs[i].finished)
+			delete jobs[i].model;
+	}
+}
+
+size_t ModelBatchLoader::add(const char *fileName, GLuint selectName, Callback callback, void *userData)
+{
+	if (!threads.empty())
+		throw logic_error("ModelBatchLoader::add() called after start()!");
+
+	Job job;
+	job.fileName = fileName;
+	job.selectName = selectName;
+	job.callback = callback;
+	job.userData = userData;
+	jobs.push_back(job);
+
+	return jobs.size() - 1;
+}
+
+void ModelBatchLoader::start()
+{
+	if (!threads.empty())
+		return;
+
+	unsigned int n = min(static_cast<size_t>(numThreads), jobs.size());
+
+	for (unsigned int i=0; i<n; ++i) {
+		threads.push_back(new sf::Thread(&ModelBatchLoader::work, this));
+		threads.back()->Launch();
+	}
+}
+
+size_t ModelBatchLoader::update()
+{
+	vector<size_t> ready;
+
+	{
+		sf::Lock lock(mutex);
+		ready.swap(parsedJobs);
+	}
+
+	for (size_t i=0; i<ready.size(); ++i) {
+		Job &job = jobs[ready[i]];
+
+		if (job.model != NULL)
+			job.model->upload();
+
+		job.finished = true;
+		++numFinished;
+
+		if (job.callback != NULL)
+			job.callback(job.model, job.fileName.c_str(), job.userData);
+	}
+
+	return jobs.size() - numFinished;
+}
+
+void ModelBatchLoader::finish()
+{
+	start();
+
+	for (size_t i=0; i<threads.size(); ++i)
+		threads[i]->Wait();
+
+	update();
+}
+
+void ModelBatchLoader::work(void *userData)
+{
+	ModelBatchLoader *loader = static_cast<ModelBatchLoader *>(userData);
+
+	while (true) {
+		size_t job;
+
+		{
+			sf::Lock lock(loader->mutex);
+			if (loader->nextJob == loader->jobs.size())
+				return;
+			job = loader->nextJob++;
+		}
+
+		loader->parseJob(loader->jobs[job]);
+
+		sf::Lock lock(loader->mutex);
+		loader->parsedJobs.push_back(job);
+	}
+}
+
+void ModelBatchLoader::parseJob(Job &job)
+{
+	Model3DS *model = new Model3DS(job.selectName);
+	// the models are already parsed on several threads
+	model->setNormalThreads(1);
+
+	try {
+		if (!model->parse(job.fileName.c_str())) {
+			delete model;
+			model = NULL;
+		}
+	} catch (exception &e) {
+		LOG3DS_ERROR(job.fileName << ": " << e.what());
+		delete model;
+		model = NULL;
+	}
+
+	job.model = model;
+}
@@ -0,0 +1,64 @@
+#ifndef _BATCH3DS_H_
+#define _BATCH3DS_H_
+
+#include <vector>
+#include <string>
+#include <SFML/System.hpp>
+
+#include "3ds.h"
+
+// Loads many models at once. Files are parsed on a fixed-size pool of worker
+// threads while the textures are uploaded on the thread calling update() or
+// finish(), which has to own the GL context. The caller owns the returned
+// models; the ones not returned yet are deleted with the loader.
+class ModelBatchLoader
+{
+	public:
+		// model is NULL when the file couldn't be loaded
+		typedef void (*Callback)(Model3DS *model, const char *fileName, void *userData);
+
+		ModelBatchLoader(unsigned int numThreads = 4);
+		~ModelBatchLoader();
+
+		// Queues a file to load, has to be called before start(). Returns the
+		// job number used by getModel().
+		size_t add(const char *fileName, GLuint selectName = 0, Callback callback = NULL, void *userData = NULL);
+		void start();
+		// Uploads the models parsed so far and runs their callbacks. Returns the
+		// number of files still being loaded.
+		size_t update();
+		// Waits for all the files and finishes them like update().
+		void finish();
+
+		// the loaded model, NULL until the job is finished or if it failed
+		Model3DS *getModel(size_t job) const { return jobs[job].finished ? jobs[job].model : NULL; }
+
+	private:
+		struct Job
+		{
+			Job(): model(NULL), callback(NULL), userData(NULL), selectName(0), finished(false) {}
+
+			string fileName;
+			Model3DS *model;
+			Callback callback;
+			void *userData;
+			GLuint selectName;
+			bool finished;
+		};
+
+		ModelBatchLoader(const ModelBatchLoader &);
+		ModelBatchLoader &operator =(const ModelBatchLoader &);
+
+		static void work(void *userData);
+		void parseJob(Job &job);
+
+		unsigned int numThreads;
+		vector<sf::Thread *> threads;
+
+		vector<Job> jobs;
+		size_t nextJob, numFinished;
+		vector<size_t> parsedJobs; // waiting for upload, guarded by mutex
+		sf::Mutex mutex;
+};
+
+#endif // _BATCH3DS_H_
@@ -0,0 +1,472 @@
+// Parser, normal kernel and draw benchmarks on generated models.
+//
+// Build with OPEN3DS_PROFILE to get the time spent on faces, on normals and
+// on the keyframer hierarchy, and with BENCH_OSMESA to measure draw() in an
+// off-screen Mesa context (e.g. llvmpipe).
+
+#include <cmath>
+
+#include "generate3ds.h"
+#include "../anim3ds.h"
+
+#ifdef BENCH_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+namespace
+{
+	const float minBenchTime = 0.5f; // seconds per measurement
+
+	struct Scenario
+	{
+		const char *name;
+		unsigned int numObjects, facesPerObject;
+	};
+
+	const Scenario scenarios[] = {
+		{"1k", 4, 256},
+		{"64k", 64, 1024},
+		{"1M", 64, 16384},
+		{"many", 4096, 16} // hierarchy and lookups dominate
+	};
+
+	void printStats(const Scenario &scenario, size_t size, unsigned int runs, float seconds, const LoadStats *stats)
+	{
+		double perRun = seconds / runs;
+
+		printf("parse %-4s %8.3f ms  %8.1f MB/s  %10.0f objects/s  %12.0f faces/s\n",
+			scenario.name, perRun*1000.0,
+			size / perRun / (1024.0*1024.0),
+			scenario.numObjects / perRun,
+			static_cast<double>(scenario.numObjects) * scenario.facesPerObject / perRun);
+
+		if (stats != NULL && stats->phases[LoadStats::parse].count > 0) {
+			printf("           faces %8.3f ms  normals %8.3f ms  hierarchy %8.3f ms\n",
+				stats->phases[LoadStats::faces].seconds / runs * 1000.0,
+				stats->phases[LoadStats::normals].seconds / runs * 1000.0,
+				stats->phases[LoadStats::keyframer].seconds / runs * 1000.0);
+		}
+	}
+
+	// normal building options of a parse
+	struct NormalOptions
+	{
+		NormalOptions(): mode(Model3DS::areaWeightedNormals), smoothing(true), numThreads(cfg3ds::normalThreads) {}
+		NormalOptions(Model3DS::NormalMode mode, bool smoothing, unsigned int numThreads): mode(mode), smoothing(smoothing), numThreads(numThreads) {}
+
+		Model3DS::NormalMode mode;
+		bool smoothing;
+		unsigned int numThreads;
+	};
+
+	void setOptions(Model3DS &model, const NormalOptions &options)
+	{
+		model.setTextureDecoding(false);
+		model.setNormalMode(options.mode);
+		model.setSmoothingGroups(options.smoothing);
+		model.setNormalThreads(options.numThreads);
+	}
+
+	// Returns the seconds per parse.
+	double benchParse(const Scenario &scenario, const vector<Byte> &data, const NormalOptions &options = NormalOptions(), bool print = true)
+	{
+		// the first run warms up the caches and the allocator
+		{
+			Model3DS model;
+			setOptions(model, options);
+			model.parse(&data[0], data.size());
+		}
+
+		LoadStats stats;
+		unsigned int runs = 0;
+		float seconds = 0.f;
+
+		while (seconds < minBenchTime) {
+			Model3DS model;
+			setOptions(model, options);
+			model.setProfiling(true);
+
+			sf::Clock clock;
+			model.parse(&data[0], data.size());
+			seconds += clock.GetElapsedTime();
+			++runs;
+
+			for (int i=0; i<LoadStats::numPhases; ++i) {
+				const LoadStats::Entry &entry = model.getStats()->phases[i];
+				stats.phases[i].seconds += entry.seconds;
+				stats.phases[i].count += entry.count;
+			}
+		}
+
+		if (print)
+			printStats(scenario, data.size(), runs, seconds, &stats);
+		return seconds / runs;
+	}
+
+	// Parse times with the different ways of building normals, on a model
+	// with smoothing groups.
+	void benchNormalModes(const Scenario &scenario, const GeneratorOptions &generatorOptions)
+	{
+		GeneratorOptions options = generatorOptions;
+		options.smoothingGroups = 4;
+
+		vector<Byte> data;
+		generate3DS(options, data);
+
+		const struct
+		{
+			const char *name;
+			NormalOptions options;
+		} modes[] = {
+			{"none", NormalOptions(Model3DS::skipNormals, false, 1)},
+			{"area", NormalOptions(Model3DS::areaWeightedNormals, false, 1)},
+			{"angle", NormalOptions(Model3DS::angleWeightedNormals, false, 1)},
+			{"angle+groups", NormalOptions(Model3DS::angleWeightedNormals, true, 1)},
+			{"angle+groups", NormalOptions(Model3DS::angleWeightedNormals, true, cfg3ds::normalThreads)}
+		};
+
+		for (size_t i=0; i<sizeof(modes)/sizeof(modes[0]); ++i) {
+			double seconds = benchParse(scenario, data, modes[i].options, false);
+			printf("normals %-4s %-12s %u thread(s)  parse %8.3f ms\n", scenario.name, modes[i].name,
+				modes[i].options.numThreads, seconds*1000.0);
+		}
+	}
+
+	// Normals of all the objects of a model in both layouts with each kernel
+	// the CPU supports; the scalar kernel is the Vector operator code.
+	void benchNormals(const Scenario &scenario, const vector<Byte> &data)
+	{
+		Model3DS model;
+		model.setTextureDecoding(false);
+		model.setSoALayout(true);
+		model.parse(&data[0], data.size());
+		
+		const vector<Object> &objects = model.getObjects();
+		size_t numVertices = 0;
+		for (size_t i=0; i<objects.size(); ++i)
+			numVertices = max(numVertices, static_cast<size_t>(objects[i].numVertices));
+		
+		vector<Vector> normals(numVertices);
+		vector<GLfloat> x(numVertices), y(numVertices), z(numVertices);
+		VertexArrays soaNormals;
+		soaNormals.x = &x[0];
+		soaNormals.y = &y[0];
+		soaNormals.z = &z[0];
+		
+		normals3ds::Kernel selected = normals3ds::getKernel();
+		
+		for (int k=0; k<normals3ds::numKernels; ++k) {
+			normals3ds::Kernel kernel = static_cast<normals3ds::Kernel>(k);
+			if (!normals3ds::setKernel(kernel))
+				continue;
+			
+			double accumulateSeconds[2], normalizeSeconds[2];
+			
+			for (int soa=0; soa<2; ++soa) {
+				unsigned int runs = 0;
+				float accumulateTime = 0.f, normalizeTime = 0.f;
+				
+				while (accumulateTime + normalizeTime < minBenchTime) {
+					for (size_t i=0; i<objects.size(); ++i) {
+						const Object &object = objects[i];
+						
+						if (soa) {
+							fill(x.begin(), x.end(), 0.f);
+							fill(y.begin(), y.end(), 0.f);
+							fill(z.begin(), z.end(), 0.f);
+							
+							sf::Clock clock;
+							normals3ds::accumulate(object.soaVertices, object.faces, object.numFaces, soaNormals);
+							accumulateTime += clock.GetElapsedTime();
+							clock.Reset();
+							normals3ds::normalize(soaNormals, object.numVertices);
+							normalizeTime += clock.GetElapsedTime();
+						} else {
+							fill(normals.begin(), normals.end(), Vector());
+							
+							sf::Clock clock;
+							normals3ds::accumulate(object.vertices, object.faces, object.numFaces, &normals[0]);
+							accumulateTime += clock.GetElapsedTime();
+							clock.Reset();
+							normals3ds::normalize(&normals[0], object.numVertices);
+							normalizeTime += clock.GetElapsedTime();
+						}
+					}
+					++runs;
+				}
+				
+				accumulateSeconds[soa] = accumulateTime / runs;
+				normalizeSeconds[soa] = normalizeTime / runs;
+			}
+			
+			printf("normals %-4s %-6s  AoS %7.3f + %7.3f ms  SoA %7.3f + %7.3f ms (accumulate + normalize)\n",
+				scenario.name, normals3ds::getKernelName(kernel),
+				accumulateSeconds[0]*1000.0, normalizeSeconds[0]*1000.0,
+				accumulateSeconds[1]*1000.0, normalizeSeconds[1]*1000.0);
+		}
+		
+		normals3ds::setKernel(selected);
+	}
+	
+	// compile() of every object, merge() of all of them into one mesh and
+	// optimize()
+	void benchCompile(const Scenario &scenario, const vector<Byte> &data)
+	{
+		Model3DS model;
+		model.setTextureDecoding(false);
+		model.parse(&data[0], data.size());
+
+		vector<DWord> all;
+		size_t numVertices = 0;
+		for (DWord i=0; i<model.getObjects().size(); ++i) {
+			all.push_back(i);
+			numVertices += model.getObjects()[i].numVertices;
+		}
+
+		unsigned int runs = 0;
+		float compileSeconds = 0.f, mergeSeconds = 0.f;
+		CompiledMesh merged;
+
+		while (compileSeconds + mergeSeconds < minBenchTime) {
+			sf::Clock clock;
+			model.compile();
+			compileSeconds += clock.GetElapsedTime();
+
+			clock.Reset();
+			model.merge(all, merged);
+			mergeSeconds += clock.GetElapsedTime();
+			++runs;
+		}
+
+		printf("compile %-4s %8.3f ms  merge %8.3f ms  %lu -> %lu vertices, %s indices\n", scenario.name,
+			compileSeconds / runs * 1000.0, mergeSeconds / runs * 1000.0,
+			static_cast<unsigned long>(numVertices), static_cast<unsigned long>(merged.vertices.size()),
+			merged.getIndexType() == GL_UNSIGNED_INT ? "32 bit" : "16 bit");
+
+		// once, it changes the meshes
+		float acmrBefore, acmrAfter;
+		sf::Clock clock;
+		model.optimize(&acmrBefore, &acmrAfter);
+
+		printf("optimize %-4s %8.3f ms  ACMR %.3f -> %.3f\n", scenario.name,
+			clock.GetElapsedTime() * 1000.0, acmrBefore, acmrAfter);
+
+		// reading the optimized model back instead of all of the above
+		string fileName = string("bench-") + scenario.name + ".bake";
+		if (!model.bake(fileName.c_str())) {
+			printf("baked %-4s can't write %s\n", scenario.name, fileName.c_str());
+			return;
+		}
+
+		runs = 0;
+		float bakedSeconds = 0.f;
+		while (bakedSeconds < minBenchTime) {
+			Model3DS baked;
+			baked.setTextureDecoding(false);
+			clock.Reset();
+			baked.parseBaked(fileName.c_str());
+			bakedSeconds += clock.GetElapsedTime();
+			++runs;
+		}
+		remove(fileName.c_str());
+
+		printf("baked %-4s %8.3f ms\n", scenario.name, bakedSeconds / runs * 1000.0);
+	}
+
+	// AnimationSampler playing forward a frame at a time and jumping around,
+	// on a model with long tracks
+	void benchAnimate(const Scenario &scenario, GeneratorOptions options)
+	{
+		options.keysPerTrack = 64;
+		vector<Byte> data;
+		generate3DS(options, data);
+
+		Model3DS model;
+		model.setTextureDecoding(false);
+		model.parse(&data[0], data.size());
+
+		AnimationSampler sampler(model);
+		vector<Pose> poses(model.getObjects().size());
+		GLfloat length = model.getLastFrame() - model.getFirstFrame() + 1;
+
+		for (int jump=0; jump<2; ++jump) {
+			unsigned int runs = 0;
+			float seconds = 0.f;
+
+			while (seconds < minBenchTime) {
+				sf::Clock clock;
+				for (int i=0; i<100; ++i, ++runs) {
+					GLfloat frame = jump ? (runs*7919 % 1000) / 1000.f * length : runs*0.25f;
+					sampler.sample(model.getFirstFrame() + fmod(frame, length), &poses[0]);
+				}
+				seconds += clock.GetElapsedTime();
+			}
+
+			printf("animate %-4s %-7s %8.3f ms  %10.1f ns/object\n", scenario.name,
+				jump ? "jumping" : "playing", seconds / runs * 1000.0,
+				seconds / runs / poses.size() * 1e9);
+		}
+	}
+
+	// pick() with rays from all around the model through its bounds, without
+	// and with BVHs, and the closest points of all the meshes to a point
+	void benchPick(const Scenario &scenario, const vector<Byte> &data)
+	{
+		Model3DS model;
+		model.setTextureDecoding(false);
+		model.parse(&data[0], data.size());
+		
+		BoundingBox bounds = model.getBounds();
+		Vector size = bounds.upper - bounds.lower;
+		
+		for (int bvhs=0; bvhs<2; ++bvhs) {
+			if (bvhs) {
+				sf::Clock clock;
+				model.buildBVHs();
+				printf("bvhs  %-4s %8.3f ms build\n", scenario.name, clock.GetElapsedTime() * 1000.0);
+			}
+			
+			unsigned int runs = 0, hits = 0;
+			float seconds = 0.f;
+			srand(1);
+			
+			while (seconds < minBenchTime) {
+				for (int i=0; i<100; ++i, ++runs) {
+					Vector target = bounds.lower + Vector(size.x*rand()/RAND_MAX, size.y*rand()/RAND_MAX, size.z*rand()/RAND_MAX);
+					Vector away = Vector(rand() - RAND_MAX/2, rand() - RAND_MAX/2, rand() - RAND_MAX/2).normalized();
+					Vector origin = target + away*size.length();
+					
+					RayHit hit;
+					sf::Clock clock;
+					hits += model.pick(origin, target - origin, hit);
+					seconds += clock.GetElapsedTime();
+				}
+			}
+			
+			printf("pick  %-4s %-7s %8.4f ms  %3.0f%% hits\n", scenario.name, bvhs ? "bvhs" : "boxes",
+				seconds / runs * 1000.0, 100.0 * hits / runs);
+		}
+		
+		// in the space of the meshes, which the generator doesn't move
+		const vector<MeshBVH> &bvhs = model.getBVHs();
+		unsigned int runs = 0;
+		float seconds = 0.f;
+		
+		while (seconds < minBenchTime) {
+			Vector point = bounds.lower + Vector(size.x*rand()/RAND_MAX, size.y*rand()/RAND_MAX, size.z*rand()/RAND_MAX);
+			
+			sf::Clock clock;
+			ClosestPoint closest;
+			for (size_t i=0; i<bvhs.size(); ++i)
+				bvhs[i].findClosestPoint(point, closest);
+			seconds += clock.GetElapsedTime();
+			++runs;
+		}
+		
+		printf("closest %-4s %8.4f ms\n", scenario.name, seconds / runs * 1000.0);
+	}
+	
+#ifdef BENCH_OSMESA
+	void *getProc(const char *name)
+	{
+		return reinterpret_cast<void *>(OSMesaGetProcAddress(name));
+	}
+
+	// draw() from client memory and from buffer objects
+	void benchDraw(const Scenario &scenario, const vector<Byte> &data)
+	{
+		const GLsizei width = 640, height = 480;
+
+		OSMesaContext context = OSMesaCreateContextExt(OSMESA_RGBA, 24, 0, 0, NULL);
+		vector<GLubyte> buffer(width*height*4);
+
+		if (context == NULL || !OSMesaMakeCurrent(context, &buffer[0], GL_UNSIGNED_BYTE, width, height)) {
+			printf("draw  %-4s can't create an OSMesa context\n", scenario.name);
+			return;
+		}
+
+		glEnable(GL_DEPTH_TEST);
+		glEnable(GL_LIGHTING);
+		glEnable(GL_LIGHT0);
+
+		glMatrixMode(GL_PROJECTION);
+		gluPerspective(90.f, static_cast<float>(width)/height, 1.f, 100000.f);
+		glMatrixMode(GL_MODELVIEW);
+		glTranslatef(-scenario.numObjects * 68.f, -64.f, -5000.f);
+
+		buffers3ds::setProcLoader(getProc);
+
+		for (int bufferObjects=0; bufferObjects<2; ++bufferObjects) {
+			Model3DS model;
+			model.setBufferObjects(bufferObjects);
+			model.load(&data[0], data.size());
+
+			unsigned int frames = 0;
+			float submitSeconds = 0.f;
+			sf::Clock total;
+
+			while (total.GetElapsedTime() < minBenchTime) {
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+				sf::Clock clock;
+				model.draw();
+				submitSeconds += clock.GetElapsedTime();
+
+				glFinish();
+				++frames;
+			}
+
+			printf("draw  %-4s %-7s %8.3f ms submit  %8.3f ms frame\n", scenario.name,
+				bufferObjects ? "buffers" : "arrays",
+				submitSeconds / frames * 1000.0, total.GetElapsedTime() / frames * 1000.0);
+		}
+
+		OSMesaDestroyContext(context);
+	}
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	// bench --write also saves the generated models for other tools
+	bool write = argc > 1 && strcmp(argv[1], "--write") == 0;
+	int result = EXIT_SUCCESS;
+
+	for (size_t i=0; i<sizeof(scenarios)/sizeof(scenarios[0]); ++i) {
+		const Scenario &scenario = scenarios[i];
+
+		GeneratorOptions options;
+		options.numObjects = scenario.numObjects;
+		options.facesPerObject = scenario.facesPerObject;
+		options.numMaterials = 4;
+		options.materialsPerObject = 2;
+		options.hierarchyDepth = 4;
+
+		vector<Byte> data;
+		generate3DS(options, data);
+
+		if (write) {
+			string fileName = string("bench-") + scenario.name + ".3ds";
+			if (!generate3DS(options, fileName.c_str())) {
+				printf("write %-4s can't write %s\n", scenario.name, fileName.c_str());
+				result = EXIT_FAILURE;
+			}
+		}
+
+		benchParse(scenario, data);
+		if (scenario.facesPerObject*scenario.numObjects >= 1024*1024) {
+			benchNormals(scenario, data);
+			benchNormalModes(scenario, options);
+			benchCompile(scenario, data);
+		}
+		if (scenario.numObjects >= 4096)
+			benchAnimate(scenario, options);
+		benchPick(scenario, data);
+
+#ifdef BENCH_OSMESA
+		benchDraw(scenario, data);
+#endif
+	}
+
+	return result;
+}
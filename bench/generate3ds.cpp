@@ -0,0 +1,292 @@
+#include "generate3ds.h"
+
+namespace
+{
+	const unsigned int gridColumns = 128;
+
+	// chunk ids the parser doesn't define
+	const Word VERSION = 0x0002;
+	const Word KEYFRAMER_HEADER = 0xB00A;
+
+	class ChunkWriter
+	{
+		public:
+			ChunkWriter(vector<Byte> &data): data(data) {}
+
+			void begin(Word id)
+			{
+				put(id);
+				starts.push_back(data.size());
+				put(static_cast<DWord>(0));
+			}
+
+			void end()
+			{
+				DWord length = data.size() - starts.back() + sizeof(Word);
+				memcpy(&data[starts.back()], &length, sizeof(length));
+				starts.pop_back();
+			}
+
+			template <typename T>
+			void put(const T &x)
+			{
+				const Byte *p = reinterpret_cast<const Byte *>(&x);
+				data.insert(data.end(), p, p + sizeof(x));
+			}
+
+			void putString(const char *s)
+			{
+				data.insert(data.end(), s, s + strlen(s) + 1);
+			}
+
+		private:
+			vector<Byte> &data;
+			vector<size_t> starts;
+	};
+
+	void objectName(char *name, unsigned int i)
+	{
+		sprintf(name, "obj%u", i);
+	}
+
+	void materialName(char *name, unsigned int i)
+	{
+		sprintf(name, "mat%u", i);
+	}
+
+	void writeColor(ChunkWriter &out, Word id, Byte r, Byte g, Byte b)
+	{
+		out.begin(id);
+		out.begin(chunks::COLOR_BYTE);
+		out.put(r);
+		out.put(g);
+		out.put(b);
+		out.end();
+		out.end();
+	}
+
+	void writeMaterial(ChunkWriter &out, const GeneratorOptions &options, unsigned int i)
+	{
+		char name[32];
+		materialName(name, i);
+
+		out.begin(chunks::EDIT_MATERIAL);
+
+		out.begin(chunks::MATERIAL_NAME);
+		out.putString(name);
+		out.end();
+
+		writeColor(out, chunks::MATERIAL_AMBIENT, 20, 20, 20);
+		writeColor(out, chunks::MATERIAL_DIFFUSE, 50 + i*40 % 200, 100, 200 - i*40 % 200);
+		writeColor(out, chunks::MATERIAL_SPECULAR, 255, 255, 255);
+
+		if (options.textureFile != NULL && i % 2 == 1) {
+			out.begin(chunks::MATERIAL_TEXMAP);
+			out.begin(chunks::TEXMAP_FILE);
+			out.putString(options.textureFile);
+			out.end();
+			out.end();
+		}
+
+		out.end();
+	}
+
+	void writeObject(ChunkWriter &out, const GeneratorOptions &options, unsigned int i)
+	{
+		char name[32];
+		objectName(name, i);
+
+		unsigned int numFaces = options.facesPerObject;
+		unsigned int rows = (numFaces + 2*gridColumns - 1) / (2*gridColumns);
+		Word numVertices = (gridColumns+1)*(rows+1);
+		GLfloat offset = i * (gridColumns + 8.f);
+
+		out.begin(chunks::EDIT_OBJECT);
+		out.putString(name);
+		out.begin(chunks::OBJECT_MESH);
+
+		out.begin(chunks::MESH_VERTICES);
+		out.put(numVertices);
+		for (unsigned int y=0; y<=rows; ++y) {
+			for (unsigned int x=0; x<=gridColumns; ++x) {
+				out.put(static_cast<GLfloat>(offset + x));
+				out.put(static_cast<GLfloat>(y));
+				out.put(static_cast<GLfloat>(sin(x*0.3f) * cos(y*0.2f) * 4.f));
+			}
+		}
+		out.end();
+
+		out.begin(chunks::MESH_MAPCOORDS);
+		out.put(numVertices);
+		for (unsigned int y=0; y<=rows; ++y) {
+			for (unsigned int x=0; x<=gridColumns; ++x) {
+				out.put(static_cast<GLfloat>(x) / gridColumns);
+				out.put(static_cast<GLfloat>(y) / rows);
+			}
+		}
+		out.end();
+
+		out.begin(chunks::MESH_FACES);
+		out.put(static_cast<Word>(numFaces));
+		for (unsigned int f=0; f<numFaces; ++f) {
+			Word cell = f/2;
+			Word a = (cell / gridColumns)*(gridColumns+1) + cell % gridColumns;
+			Word flag = 7;
+
+			out.put(a);
+			if (f % 2 == 0) {
+				out.put(static_cast<Word>(a + 1));
+				out.put(static_cast<Word>(a + gridColumns + 2));
+			} else {
+				out.put(static_cast<Word>(a + gridColumns + 2));
+				out.put(static_cast<Word>(a + gridColumns + 1));
+			}
+			out.put(flag);
+		}
+
+		unsigned int numMaterials = min(options.materialsPerObject, options.numMaterials);
+		for (unsigned int m=0; m<numMaterials; ++m) {
+			char material[32];
+			materialName(material, (i + m) % options.numMaterials);
+
+			unsigned int first = numFaces * m / numMaterials;
+			unsigned int last = numFaces * (m+1) / numMaterials;
+
+			out.begin(chunks::FACES_MATERIALS);
+			out.putString(material);
+			out.put(static_cast<Word>(last - first));
+			for (unsigned int f=first; f<last; ++f)
+				out.put(static_cast<Word>(f));
+			out.end();
+		}
+
+		if (options.smoothingGroups != 0) {
+			out.begin(chunks::FACES_SMOOTHING);
+			for (unsigned int f=0; f<numFaces; ++f) {
+				unsigned int band = f/(2*gridColumns) * options.smoothingGroups / rows;
+				out.put(static_cast<DWord>(1) << band % 32);
+			}
+			out.end();
+		}
+
+		out.end(); // MESH_FACES
+
+		out.begin(chunks::MESH_LOCALCOORDS);
+		out.put(Vector(1.f, 0.f, 0.f));
+		out.put(Vector(0.f, 1.f, 0.f));
+		out.put(Vector(0.f, 0.f, 1.f));
+		out.put(Vector(offset, 0.f, 0.f));
+		out.end();
+
+		out.end(); // OBJECT_MESH
+		out.end(); // EDIT_OBJECT
+	}
+
+	void writeTrackHeader(ChunkWriter &out, Word id, unsigned int numKeys)
+	{
+		out.begin(id);
+		out.put(static_cast<Word>(0));
+		out.put(static_cast<DWord>(0));
+		out.put(static_cast<DWord>(0));
+		out.put(static_cast<DWord>(numKeys));
+	}
+
+	void writeNode(ChunkWriter &out, const GeneratorOptions &options, unsigned int i)
+	{
+		char name[32];
+		objectName(name, i);
+
+		unsigned int numKeys = max(options.keysPerTrack, 1u);
+
+		out.begin(chunks::KEYFRAMER_MESHINFO);
+
+		out.begin(chunks::MESHINFO_HIERARCHY);
+		out.putString(name);
+		out.put(static_cast<Word>(0));
+		out.put(static_cast<Word>(0));
+		out.put(static_cast<Word>(options.hierarchyDepth > 1 ? i % options.hierarchyDepth : 0));
+		out.end();
+
+		out.begin(chunks::MESHINFO_PIVOT);
+		out.put(Vector());
+		out.end();
+
+		writeTrackHeader(out, chunks::MESHINFO_POSTRACK, numKeys);
+		for (unsigned int k=0; k<numKeys; ++k) {
+			out.put(static_cast<DWord>(k*10));
+			out.put(static_cast<Word>(0));
+			out.put(Vector(i * (gridColumns + 8.f), 0.f, k*2.f));
+		}
+		out.end();
+
+		writeTrackHeader(out, chunks::MESHINFO_ROTTRACK, numKeys);
+		for (unsigned int k=0; k<numKeys; ++k) {
+			out.put(static_cast<DWord>(k*10));
+			out.put(static_cast<Word>(0));
+			out.put(static_cast<GLfloat>(k == 0 ? 0.f : 0.1f));
+			out.put(Vector(0.f, 0.f, 1.f));
+		}
+		out.end();
+
+		writeTrackHeader(out, chunks::MESHINFO_SCALETRACK, numKeys);
+		for (unsigned int k=0; k<numKeys; ++k) {
+			out.put(static_cast<DWord>(k*10));
+			out.put(static_cast<Word>(0));
+			out.put(Vector(1.f, 1.f, 1.f));
+		}
+		out.end();
+
+		out.end();
+	}
+}
+
+void generate3DS(const GeneratorOptions &options, vector<Byte> &data)
+{
+	data.clear();
+	ChunkWriter out(data);
+
+	out.begin(chunks::MAIN);
+
+	out.begin(VERSION);
+	out.put(static_cast<DWord>(3));
+	out.end();
+
+	out.begin(chunks::EDIT);
+	for (unsigned int i=0; i<options.numMaterials; ++i)
+		writeMaterial(out, options, i);
+	for (unsigned int i=0; i<options.numObjects; ++i)
+		writeObject(out, options, i);
+	out.end();
+
+	if (options.keyframer) {
+		out.begin(chunks::KEYFRAMER);
+
+		out.begin(KEYFRAMER_HEADER);
+		out.put(static_cast<Word>(5));
+		out.putString("generated");
+		out.put(static_cast<DWord>(options.keysPerTrack * 10));
+		out.end();
+
+		for (unsigned int i=0; i<options.numObjects; ++i)
+			writeNode(out, options, i);
+
+		out.end();
+	}
+
+	out.end();
+}
+
+bool generate3DS(const GeneratorOptions &options, const char *fileName)
+{
+	vector<Byte> data;
+	generate3DS(options, data);
+
+	FILE *fp = fopen(fileName, "wb");
+	if (fp == NULL)
+		return false;
+
+	bool result = fwrite(&data[0], 1, data.size(), fp) == data.size();
+	fclose(fp);
+
+	return result;
+}
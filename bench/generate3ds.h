@@ -0,0 +1,39 @@
+#ifndef _GENERATE3DS_H_
+#define _GENERATE3DS_H_
+
+#include <vector>
+
+#include "../3ds.h"
+
+// Shape of a synthetic model. Every object is a wavy grid of triangles, so
+// the normals are not trivial, and gets the materials in turn.
+struct GeneratorOptions
+{
+	GeneratorOptions():
+		numObjects(1),
+		facesPerObject(1024),
+		numMaterials(1),
+		materialsPerObject(1),
+		textureFile(NULL),
+		keyframer(true),
+		hierarchyDepth(3),
+		keysPerTrack(2),
+		smoothingGroups(0)
+	{}
+
+	unsigned int numObjects;
+	unsigned int facesPerObject; // at most 65535 and limited by 65535 vertices
+	unsigned int numMaterials;
+	unsigned int materialsPerObject;
+	const char *textureFile; // used by every other material when not NULL
+	bool keyframer;
+	unsigned int hierarchyDepth; // objects are chained this deep under the keyframer
+	unsigned int keysPerTrack;
+	unsigned int smoothingGroups; // bands of rows smoothed apart, 0 for no FACES_SMOOTHING
+};
+
+// Writes a valid .3ds file.
+void generate3DS(const GeneratorOptions &options, vector<Byte> &data);
+bool generate3DS(const GeneratorOptions &options, const char *fileName);
+
+#endif // _GENERATE3DS_H_
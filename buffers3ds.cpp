@@ -0,0 +1,110 @@
+#include "buffers3ds.h"
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(_WIN32)
+	#include <windows.h>
+#else
+	#include <GL/glx.h>
+#endif
+
+#ifndef APIENTRY
+	#define APIENTRY
+#endif
+
+namespace
+{
+	typedef void (APIENTRY *GenBuffers)(GLsizei n, GLuint *buffers);
+	typedef void (APIENTRY *DeleteBuffers)(GLsizei n, const GLuint *buffers);
+	typedef void (APIENTRY *BindBuffer)(GLenum target, GLuint buffer);
+	typedef void (APIENTRY *BufferData)(GLenum target, ptrdiff_t size, const void *data, GLenum usage);
+	typedef void (APIENTRY *BufferSubData)(GLenum target, ptrdiff_t offset, ptrdiff_t size, const void *data);
+	
+	GenBuffers genBuffersProc = NULL;
+	DeleteBuffers deleteBuffersProc = NULL;
+	BindBuffer bindBufferProc = NULL;
+	BufferData bufferDataProc = NULL;
+	BufferSubData bufferSubDataProc = NULL;
+	
+	buffers3ds::ProcLoader procLoader = NULL;
+	bool loaded = false;
+	
+	void *getProc(const char *name)
+	{
+		if (procLoader != NULL)
+			return procLoader(name);
+		
+#if defined(_WIN32)
+		return reinterpret_cast<void *>(wglGetProcAddress(name));
+#else
+		return reinterpret_cast<void *>(glXGetProcAddressARB(reinterpret_cast<const GLubyte *>(name)));
+#endif
+	}
+	
+	// the core name from GL 1.5 on, the one of ARB_vertex_buffer_object
+	// before
+	template <typename T>
+	bool getProc(T &proc, bool core, const char *name, const char *arbName)
+	{
+		proc = reinterpret_cast<T>(getProc(core ? name : arbName));
+		return proc != NULL;
+	}
+}
+
+namespace buffers3ds
+{
+	void setProcLoader(ProcLoader loader)
+	{
+		procLoader = loader;
+	}
+	
+	bool load()
+	{
+		if (!loaded) {
+			loaded = true;
+			
+			// glXGetProcAddress returns an address for any name, so the
+			// version has to be checked too
+			const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+			const char *extensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+			bool core = version != NULL && (version[0] > '1' || (version[0] == '1' && version[2] >= '5'));
+			bool available = core || (extensions != NULL && strstr(extensions, "GL_ARB_vertex_buffer_object") != NULL);
+			
+			if (!available
+				|| !getProc(genBuffersProc, core, "glGenBuffers", "glGenBuffersARB")
+				|| !getProc(deleteBuffersProc, core, "glDeleteBuffers", "glDeleteBuffersARB")
+				|| !getProc(bindBufferProc, core, "glBindBuffer", "glBindBufferARB")
+				|| !getProc(bufferDataProc, core, "glBufferData", "glBufferDataARB")
+				|| !getProc(bufferSubDataProc, core, "glBufferSubData", "glBufferSubDataARB"))
+				genBuffersProc = NULL;
+		}
+		
+		return genBuffersProc != NULL;
+	}
+	
+	void genBuffers(GLsizei n, GLuint *buffers)
+	{
+		genBuffersProc(n, buffers);
+	}
+	
+	void deleteBuffers(GLsizei n, const GLuint *buffers)
+	{
+		deleteBuffersProc(n, buffers);
+	}
+	
+	void bindBuffer(GLenum target, GLuint buffer)
+	{
+		bindBufferProc(target, buffer);
+	}
+	
+	void bufferData(GLenum target, size_t size, const void *data, GLenum usage)
+	{
+		bufferDataProc(target, size, data, usage);
+	}
+	
+	void bufferSubData(GLenum target, size_t offset, size_t size, const void *data)
+	{
+		bufferSubDataProc(target, offset, size, data);
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef _BUFFERS3DS_H_
+#define _BUFFERS3DS_H_
+
+#include <cstdlib>
+#include <GL/gl.h>
+
+// the GL 1.5 names, gl.h of some platforms stops at GL 1.1
+#ifndef GL_ARRAY_BUFFER
+	#define GL_ARRAY_BUFFER 0x8892
+	#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+	#define GL_STATIC_DRAW 0x88E4
+#endif
+
+// Buffer objects. Their entry points are looked up at run time, with
+// wglGetProcAddress() or glXGetProcAddressARB(), since the GL library of
+// Windows and older Linux systems doesn't export them.
+namespace buffers3ds
+{
+	typedef void *(*ProcLoader)(const char *name);
+	
+	// Replaces the platform lookup, e.g. with OSMesaGetProcAddress(). Has to
+	// be called before the first load().
+	void setProcLoader(ProcLoader loader);
+	// Looks the entry points up the first time, which needs a current GL
+	// context. Returns whether buffer objects can be used.
+	bool load();
+	
+	void genBuffers(GLsizei n, GLuint *buffers);
+	void deleteBuffers(GLsizei n, const GLuint *buffers);
+	void bindBuffer(GLenum target, GLuint buffer);
+	void bufferData(GLenum target, size_t size, const void *data, GLenum usage);
+	void bufferSubData(GLenum target, size_t offset, size_t size, const void *data);
+}
+
+#endif // _BUFFERS3DS_H_
@@ -0,0 +1,401 @@
+#include "bvh3ds.h"
+#include "ray3ds.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	const int numBins = 16;
+	const Word maxLeafFaces = 4;
+	// of visiting a node, relative to intersecting a triangle
+	const GLfloat traversalCost = 1.f;
+
+	GLfloat getArea(const BoundingBox &box)
+	{
+		if (box.isEmpty())
+			return 0.f;
+
+		Vector size = box.upper - box.lower;
+		return 2.f*(size.x*size.y + size.y*size.z + size.z*size.x);
+	}
+
+	GLfloat getComponent(const Vector &v, int axis)
+	{
+		return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+	}
+
+	struct Bin
+	{
+		Bin(): count(0) {}
+
+		BoundingBox bounds;
+		DWord count;
+	};
+
+	// the bin of a centroid along axis, for the centroid bounds of a node
+	struct Binning
+	{
+		Binning(const BoundingBox &centroids, int axis):
+			axis(axis),
+			lower(getComponent(centroids.lower, axis)),
+			scale(numBins / (getComponent(centroids.upper, axis) - lower))
+		{}
+
+		int operator ()(const Vector &centroid) const
+		{
+			GLfloat bin = (getComponent(centroid, axis) - lower) * scale;
+			// also for NaN
+			if (!(bin > 0.f))
+				return 0;
+			return bin < numBins ? static_cast<int>(bin) : numBins - 1;
+		}
+
+		int axis;
+		GLfloat lower, scale;
+	};
+
+	struct IsLeftOf
+	{
+		IsLeftOf(const Binning &binning, int split, const vector<Vector> &centroids): binning(binning), split(split), centroids(centroids) {}
+
+		bool operator ()(Word face) const { return binning(centroids[face]) < split; }
+
+		const Binning &binning;
+		int split;
+		const vector<Vector> &centroids;
+	};
+
+	// separating axis test of Akenine-Möller: the three axes of the box,
+	// the triangle's normal and the cross products of their edges
+	bool overlaps(const BoundingBox &box, const Vector &a, const Vector &b, const Vector &c)
+	{
+		Vector center = (box.lower + box.upper) * 0.5f;
+		Vector half = (box.upper - box.lower) * 0.5f;
+		Vector v[3] = {a - center, b - center, c - center};
+		Vector edges[3] = {v[1] - v[0], v[2] - v[1], v[0] - v[2]};
+		Vector units[3] = {Vector(1.f, 0.f, 0.f), Vector(0.f, 1.f, 0.f), Vector(0.f, 0.f, 1.f)};
+
+		Vector axes[13];
+		for (int i=0; i<3; ++i) {
+			axes[i] = units[i];
+			for (int j=0; j<3; ++j)
+				axes[4 + i*3 + j] = units[i] * edges[j];
+		}
+		axes[3] = edges[0] * edges[1];
+
+		for (int i=0; i<13; ++i) {
+			const Vector &axis = axes[i];
+			GLfloat p0 = v[0].dotProduct(axis), p1 = v[1].dotProduct(axis), p2 = v[2].dotProduct(axis);
+			GLfloat radius = half.x*fabs(axis.x) + half.y*fabs(axis.y) + half.z*fabs(axis.z);
+
+			if (min(p0, min(p1, p2)) > radius || max(p0, max(p1, p2)) < -radius)
+				return false;
+		}
+		return true;
+	}
+
+	// Ericson, "Real-Time Collision Detection" 5.1.5, by the region of the
+	// triangle the point projects to
+	Vector getClosestPoint(const Vector &p, const Vector &a, const Vector &b, const Vector &c)
+	{
+		Vector ab = b - a, ac = c - a, ap = p - a;
+		GLfloat d1 = ab.dotProduct(ap), d2 = ac.dotProduct(ap);
+		if (d1 <= 0.f && d2 <= 0.f)
+			return a;
+
+		Vector bp = p - b;
+		GLfloat d3 = ab.dotProduct(bp), d4 = ac.dotProduct(bp);
+		if (d3 >= 0.f && d4 <= d3)
+			return b;
+
+		GLfloat vc = d1*d4 - d3*d2;
+		if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+			return a + ab*(d1 / (d1 - d3));
+
+		Vector cp = p - c;
+		GLfloat d5 = ab.dotProduct(cp), d6 = ac.dotProduct(cp);
+		if (d6 >= 0.f && d5 <= d6)
+			return c;
+
+		GLfloat vb = d5*d2 - d1*d6;
+		if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+			return a + ac*(d2 / (d2 - d6));
+
+		GLfloat va = d3*d6 - d5*d4;
+		if (va <= 0.f && d4 - d3 >= 0.f && d5 - d6 >= 0.f)
+			return b + (c - b)*((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+		GLfloat denominator = 1.f / (va + vb + vc);
+		return a + ab*(vb*denominator) + ac*(vc*denominator);
+	}
+
+	GLfloat getDistanceSquared(const Vector &p, const BoundingBox &box)
+	{
+		GLfloat dx = max(max(box.lower.x - p.x, p.x - box.upper.x), 0.f);
+		GLfloat dy = max(max(box.lower.y - p.y, p.y - box.upper.y), 0.f);
+		GLfloat dz = max(max(box.lower.z - p.z, p.z - box.upper.z), 0.f);
+		return dx*dx + dy*dy + dz*dz;
+	}
+
+	bool isOverlapping(const BoundingBox &a, const BoundingBox &b)
+	{
+		return a.lower.x <= b.upper.x && b.lower.x <= a.upper.x
+			&& a.lower.y <= b.upper.y && b.lower.y <= a.upper.y
+			&& a.lower.z <= b.upper.z && b.lower.z <= a.upper.z;
+	}
+}
+
+void MeshBVH::build(const Vertex *vertices, Word numVertices, const Face *faces, Word numFaces)
+{
+	this->vertices = vertices;
+	this->faces = faces;
+	this->numVertices = numVertices;
+	nodes.clear();
+	faceIndices.clear();
+
+	vector<BoundingBox> faceBounds(numFaces);
+	vector<Vector> centroids(numFaces);
+	for (Word i=0; i<numFaces; ++i) {
+		const Face &face = faces[i];
+		if (face.vertexA >= numVertices || face.vertexB >= numVertices || face.vertexC >= numVertices)
+			continue;
+
+		faceBounds[i].add(vertices[face.vertexA]);
+		faceBounds[i].add(vertices[face.vertexB]);
+		faceBounds[i].add(vertices[face.vertexC]);
+		centroids[i] = (faceBounds[i].lower + faceBounds[i].upper) * 0.5f;
+		faceIndices.push_back(i);
+	}
+
+	if (faceIndices.empty())
+		return;
+
+	nodes.reserve(2*faceIndices.size() / maxLeafFaces + 1);
+	Node root;
+	root.first = 0;
+	root.numFaces = faceIndices.size();
+	root.depth = 0;
+	nodes.push_back(root);
+
+	// the nodes are split in the order they are created, which keeps the
+	// children of each node together
+	for (size_t n=0; n<nodes.size(); ++n) {
+		DWord first = nodes[n].first;
+		Word count = nodes[n].numFaces;
+
+		BoundingBox bounds, centroidBounds;
+		for (DWord i=first; i<first + count; ++i) {
+			bounds.add(faceBounds[faceIndices[i]]);
+			centroidBounds.add(centroids[faceIndices[i]]);
+		}
+		nodes[n].bounds = bounds;
+
+		if (count <= maxLeafFaces || nodes[n].depth + 1 >= maxDepth)
+			continue;
+
+		// the cheapest split between bins of the three axes
+		GLfloat bestCost = count;
+		int bestAxis = -1, bestSplit = 0;
+		GLfloat area = getArea(bounds);
+
+		for (int axis=0; axis<3; ++axis) {
+			// all the centroids in one bin
+			if (!(getComponent(centroidBounds.upper, axis) > getComponent(centroidBounds.lower, axis)))
+				continue;
+
+			Binning binning(centroidBounds, axis);
+			Bin bins[numBins];
+			for (DWord i=first; i<first + count; ++i) {
+				Bin &bin = bins[binning(centroids[faceIndices[i]])];
+				bin.bounds.add(faceBounds[faceIndices[i]]);
+				++bin.count;
+			}
+
+			// the right sides swept from the end, then the left ones
+			GLfloat rightCosts[numBins];
+			BoundingBox right;
+			DWord rightCount = 0;
+			for (int i=numBins-1; i>0; --i) {
+				right.add(bins[i].bounds);
+				rightCount += bins[i].count;
+				rightCosts[i] = getArea(right) * rightCount;
+			}
+
+			BoundingBox left;
+			DWord leftCount = 0;
+			for (int split=1; split<numBins; ++split) {
+				left.add(bins[split-1].bounds);
+				leftCount += bins[split-1].count;
+				if (leftCount == 0 || leftCount == count)
+					continue;
+
+				GLfloat cost = traversalCost + (getArea(left) * leftCount + rightCosts[split]) / area;
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+
+		if (bestAxis < 0)
+			continue;
+
+		Binning binning(centroidBounds, bestAxis);
+		Word *begin = &faceIndices[0] + first;
+		Word *middle = partition(begin, begin + count, IsLeftOf(binning, bestSplit, centroids));
+
+		Node child;
+		child.depth = nodes[n].depth + 1;
+		child.first = first;
+		child.numFaces = middle - begin;
+		Node other = child;
+		other.first = first + child.numFaces;
+		other.numFaces = count - child.numFaces;
+
+		nodes[n].first = nodes.size();
+		nodes[n].numFaces = 0;
+		nodes.push_back(child);
+		nodes.push_back(other);
+	}
+}
+
+bool MeshBVH::intersectRay(const Vector &origin, const Vector &direction, RayHit &hit) const
+{
+	if (nodes.empty())
+		return false;
+
+	Vector inverseDirection = ray3ds::invert(direction);
+	bool found = false;
+
+	DWord stack[maxDepth];
+	size_t size = 0;
+	DWord n = 0;
+
+	if (!ray3ds::intersectBox(origin, inverseDirection, nodes[0].bounds, hit.distance))
+		return false;
+
+	while (true) {
+		const Node &node = nodes[n];
+
+		if (node.numFaces != 0) {
+			for (DWord i=node.first; i<node.first + node.numFaces; ++i) {
+				const Face &face = faces[faceIndices[i]];
+				if (ray3ds::intersectTriangle(origin, direction, vertices[face.vertexA], vertices[face.vertexB], vertices[face.vertexC], hit.distance, hit.u, hit.v)) {
+					hit.face = faceIndices[i];
+					found = true;
+				}
+			}
+		} else {
+			// the nearer child first, the other one later
+			GLfloat distanceA, distanceB;
+			bool a = ray3ds::intersectBox(origin, inverseDirection, nodes[node.first].bounds, hit.distance, &distanceA);
+			bool b = ray3ds::intersectBox(origin, inverseDirection, nodes[node.first + 1].bounds, hit.distance, &distanceB);
+
+			if (a && b) {
+				bool swap = distanceB < distanceA;
+				stack[size++] = node.first + (swap ? 0 : 1);
+				n = node.first + (swap ? 1 : 0);
+				continue;
+			}
+			if (a || b) {
+				n = node.first + (a ? 0 : 1);
+				continue;
+			}
+		}
+
+		if (size == 0)
+			break;
+		n = stack[--size];
+	}
+
+	return found;
+}
+
+void MeshBVH::findOverlaps(const BoundingBox &box, vector<DWord> &faceList) const
+{
+	if (nodes.empty() || box.isEmpty())
+		return;
+
+	DWord stack[maxDepth];
+	size_t size = 0;
+	stack[size++] = 0;
+
+	while (size != 0) {
+		const Node &node = nodes[stack[--size]];
+		if (!isOverlapping(node.bounds, box))
+			continue;
+
+		if (node.numFaces == 0) {
+			stack[size++] = node.first;
+			stack[size++] = node.first + 1;
+			continue;
+		}
+
+		for (DWord i=node.first; i<node.first + node.numFaces; ++i) {
+			const Face &face = faces[faceIndices[i]];
+			if (overlaps(box, vertices[face.vertexA], vertices[face.vertexB], vertices[face.vertexC]))
+				faceList.push_back(faceIndices[i]);
+		}
+	}
+}
+
+bool MeshBVH::findClosestPoint(const Vector &point, ClosestPoint &closest) const
+{
+	if (nodes.empty() || getDistanceSquared(point, nodes[0].bounds) >= closest.distanceSquared)
+		return false;
+
+	bool found = false;
+
+	DWord stack[maxDepth];
+	size_t size = 0;
+	DWord n = 0;
+
+	while (true) {
+		const Node &node = nodes[n];
+
+		if (node.numFaces != 0) {
+			for (DWord i=node.first; i<node.first + node.numFaces; ++i) {
+				const Face &face = faces[faceIndices[i]];
+				Vector p = getClosestPoint(point, vertices[face.vertexA], vertices[face.vertexB], vertices[face.vertexC]);
+				Vector d = p - point;
+				GLfloat distanceSquared = d.dotProduct(d);
+
+				if (distanceSquared < closest.distanceSquared) {
+					closest.face = faceIndices[i];
+					closest.point = p;
+					closest.distanceSquared = distanceSquared;
+					found = true;
+				}
+			}
+		} else {
+			GLfloat distanceA = getDistanceSquared(point, nodes[node.first].bounds);
+			GLfloat distanceB = getDistanceSquared(point, nodes[node.first + 1].bounds);
+			bool a = distanceA < closest.distanceSquared, b = distanceB < closest.distanceSquared;
+
+			if (a && b) {
+				bool swap = distanceB < distanceA;
+				stack[size++] = node.first + (swap ? 0 : 1);
+				n = node.first + (swap ? 1 : 0);
+				continue;
+			}
+			if (a || b) {
+				n = node.first + (a ? 0 : 1);
+				continue;
+			}
+		}
+
+		// the far children pushed earlier may be out of reach by now
+		n = noIndex;
+		while (size != 0 && n == noIndex) {
+			DWord next = stack[--size];
+			if (getDistanceSquared(point, nodes[next].bounds) < closest.distanceSquared)
+				n = next;
+		}
+		if (n == noIndex)
+			break;
+	}
+
+	return found;
+}
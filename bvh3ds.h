@@ -0,0 +1,67 @@
+#ifndef _BVH3DS_H_
+#define _BVH3DS_H_
+
+#include <cstdlib>
+#include <vector>
+#include <GL/gl.h>
+
+#include "types3ds.h"
+
+using namespace std;
+
+// The point of a mesh closest to another, see MeshBVH::findClosestPoint().
+struct ClosestPoint
+{
+	ClosestPoint(): face(noIndex), distanceSquared(FLT_MAX) {}
+
+	DWord face; // noIndex for none
+	Vector point;
+	GLfloat distanceSquared;
+};
+
+// A bounding volume hierarchy over the triangles of one mesh, in the mesh's
+// own space. It is built with the surface area heuristic on binned
+// centroids and stored flat: the two children of a node are next to each
+// other in nodes, and the faces of the leaves are ranges of faceIndices.
+// The vertices and faces are not copied and must outlive it, as the arena
+// of a model does.
+class MeshBVH
+{
+	public:
+		// 32 bytes, two to a cache line
+		struct Node
+		{
+			BoundingBox bounds;
+			DWord first; // the first child, or of faceIndices for a leaf
+			Word numFaces; // 0 for an inner node
+			Word depth;
+		};
+
+		// bounds the traversal stacks
+		static const Word maxDepth = 64;
+
+		MeshBVH(): vertices(NULL), faces(NULL), numVertices(0) {}
+
+		// Faces with vertices out of range are left out.
+		void build(const Vertex *vertices, Word numVertices, const Face *faces, Word numFaces);
+		bool isEmpty() const { return nodes.empty(); }
+
+		// Like ray3ds::intersectFaces(): the closest face hit before
+		// hit.distance fills the face, distance, u and v of hit.
+		bool intersectRay(const Vector &origin, const Vector &direction, RayHit &hit) const;
+		// Appends the faces that intersect box.
+		void findOverlaps(const BoundingBox &box, vector<DWord> &faceList) const;
+		// The closest point of the faces to point, if closer than
+		// sqrt(closest.distanceSquared), which then changes.
+		bool findClosestPoint(const Vector &point, ClosestPoint &closest) const;
+
+		vector<Node> nodes; // the root first
+		vector<Word> faceIndices;
+
+	private:
+		const Vertex *vertices;
+		const Face *faces;
+		Word numVertices;
+};
+
+#endif // _BVH3DS_H_
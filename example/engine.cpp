@@ -53,12 +53,14 @@ void Engine::init()
 	clock = new sf::Clock;
 
 	model = new Model3DS(cfg::modelName);
-	if (!model->load("test.3ds")) {
+	model->setBufferObjects(true);
+	if (!model->parse("test.3ds")) {
 		cout << "Can't find model file!" << endl;
 		exit(1);
 	}
-	
-	glSelectBuffer(cfg::selectBufferSize, selectBuffer);
+	// the model never changes shape, reorder it once for the GPU
+	model->optimize();
+	model->upload();
 
 	// Set color and depth clear value
 	//glClearDepth(1.f);
@@ -86,19 +88,12 @@ void Engine::mainLoop()
 	}
 }
 
-void Engine::display(bool select)
+void Engine::display()
 {
 	// Setup a perspective projection
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
 	
-	if (select) {
-		GLint viewport[4];
-		glGetIntegerv(GL_VIEWPORT, viewport);
-		
-		gluPickMatrix(static_cast<GLdouble>(lastMouseX), static_cast<GLdouble>(viewport[3] - lastMouseY), cfg::selectTolerance, cfg::selectTolerance, viewport);
-	}
-	
 	gluPerspective(90.f, app->GetWidth()/static_cast<float>(app->GetHeight()), 1.f, 10000.f);
 	
 	// Clear color and depth buffer
@@ -116,7 +111,7 @@ void Engine::display(bool select)
 	glRotatef(-90, 1.f, 0.f, 0.f);
 
 	// Axes
-	if (!select && drawAxes) {
+	if (drawAxes) {
 		glDisable(GL_LIGHTING);
 		glLineWidth(2.f);
 		
@@ -143,8 +138,7 @@ void Engine::display(bool select)
 	model->draw();
 
 	// Finally, display rendered frame on screen
-	if (!select)
-		app->Display();
+	app->Display();
 
 	++frames;
 	if (frames >= 1000) {
@@ -208,31 +202,29 @@ void Engine::processKeyPressed(sf::Event &event)
 void Engine::processMouseButtonPressed(sf::Event &event)
 {
 	if (event.MouseButton.Button == sf::Mouse::Left) {
-		glRenderMode(GL_SELECT);
-		glInitNames();
-		glPushName(cfg::emptySelectName);
-		display(true);
-		GLint nHits = glRenderMode(GL_RENDER);
-		cout << "nhits: " << nHits << endl;
+		// the ray under the mouse from the near to the far plane, in the
+		// space display() left the model drawn in
+		GLdouble modelview[16], projection[16];
+		GLint viewport[4];
+		glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
+		glGetDoublev(GL_PROJECTION_MATRIX, projection);
+		glGetIntegerv(GL_VIEWPORT, viewport);
 		
-		GLint selectedName = -1;
-		GLuint lowestZMin = 0xFFFFFFFF;
+		GLdouble windowX = lastMouseX, windowY = viewport[3] - lastMouseY;
+		GLdouble nearX, nearY, nearZ, farX, farY, farZ;
+		gluUnProject(windowX, windowY, 0.0, modelview, projection, viewport, &nearX, &nearY, &nearZ);
+		gluUnProject(windowX, windowY, 1.0, modelview, projection, viewport, &farX, &farY, &farZ);
 		
-		for (int i = 0, index = 0; i < nHits; ++i) {
-			GLint nItems = selectBuffer[index++];
-			GLuint zMin = selectBuffer[index++];
-			//GLuint zMax = selectBuffer[index++];
-			++index;
-						
-			if (zMin < lowestZMin) {
-				selectedName = selectBuffer[index+nItems-1];
-				lowestZMin = zMin;
-			}
-			
-			index += nItems;
-		}
+		Vector origin(nearX, nearY, nearZ);
+		Vector direction(farX - nearX, farY - nearY, farZ - nearZ);
 		
-		model->select(selectedName);
+		RayHit hit;
+		if (model->pick(origin, direction, hit)) {
+			const Object &object = model->getObjects()[hit.object];
+			cout << "picked " << (object.name != NULL ? object.name : "") << ", face " << hit.face << endl;
+			model->select(object.selectName);
+		} else
+			model->select(-1);
 		
 		transformingObject = true;
 	} else if (event.MouseButton.Button == sf::Mouse::Right)
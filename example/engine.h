@@ -15,10 +15,6 @@ namespace cfg
 	const GLfloat positionSpeed = 0.005f;
 	const GLfloat zoomSpeed = 0.05f;
 	
-	const GLdouble selectTolerance = 2.0;
-	const int selectBufferSize = 256;
-	const GLint emptySelectName = 0xFFFFFFFF;
-	
 	const GLuint modelName = 0;
 	
 	const GLfloat ambientColor[] = {0.2f, 0.2f, 0.2f, 1.f};
@@ -38,7 +34,7 @@ class Engine
 	private:
 		void init();
 		void mainLoop();
-		void display(bool select = false);
+		void display();
 		void processEvents();
 		void processKeyPressed(sf::Event &event);
 		void processMouseButtonPressed(sf::Event &event);
@@ -65,7 +61,6 @@ class Engine
 		bool zoomingCamera;
 		GLfloat cameraDistance;
 		
-		GLuint selectBuffer[cfg::selectBufferSize];
 		bool transformingObject;
 		Axis transformationAxis;
 		Transformation transformation;
@@ -0,0 +1,27 @@
+#include "log3ds.h"
+
+#include <cstdio>
+
+namespace
+{
+	void defaultSink(log3ds::Level level, const char *message, void *)
+	{
+		static const char *prefixes[] = {"debug", "info", "warning", "error"};
+
+		fprintf(stderr, "3ds %s: %s\n", prefixes[level], message);
+	}
+
+	log3ds::Sink currentSink = defaultSink;
+	void *currentUserData = NULL;
+}
+
+void log3ds::setSink(Sink sink, void *userData)
+{
+	currentSink = (sink != NULL ? sink : defaultSink);
+	currentUserData = userData;
+}
+
+void log3ds::write(Level level, const char *message)
+{
+	currentSink(level, message, currentUserData);
+}
@@ -0,0 +1,58 @@
+#ifndef _LOG3DS_H_
+#define _LOG3DS_H_
+
+#include <sstream>
+
+// Messages below OPEN3DS_LOG_LEVEL are compiled out entirely, including the
+// evaluation of their arguments: 0 - debug, 1 - info, 2 - warning, 3 - error,
+// 4 - nothing.
+#ifndef OPEN3DS_LOG_LEVEL
+	#define OPEN3DS_LOG_LEVEL 2
+#endif
+
+namespace log3ds
+{
+	enum Level { debug, info, warning, error };
+
+	// Receives every message that wasn't compiled out. message has no
+	// trailing newline.
+	typedef void (*Sink)(Level level, const char *message, void *userData);
+
+	// Routes messages to sink, NULL restores the default one which writes to
+	// stderr without flushing.
+	void setSink(Sink sink, void *userData = NULL);
+	void write(Level level, const char *message);
+}
+
+#define LOG3DS_WRITE(level, message) \
+	do { \
+		std::ostringstream log3dsMessage; \
+		log3dsMessage << message; \
+		log3ds::write(level, log3dsMessage.str().c_str()); \
+	} while (false)
+
+#if OPEN3DS_LOG_LEVEL <= 0
+	#define LOG3DS_DEBUG(message) LOG3DS_WRITE(log3ds::debug, message)
+#else
+	#define LOG3DS_DEBUG(message) do {} while (false)
+#endif
+
+#if OPEN3DS_LOG_LEVEL <= 1
+	#define LOG3DS_INFO(message) LOG3DS_WRITE(log3ds::info, message)
+#else
+	#define LOG3DS_INFO(message) do {} while (false)
+#endif
+
+#if OPEN3DS_LOG_LEVEL <= 2
+	#define LOG3DS_WARNING(message) LOG3DS_WRITE(log3ds::warning, message)
+#else
+	#define LOG3DS_WARNING(message) do {} while (false)
+#endif
+
+#if OPEN3DS_LOG_LEVEL <= 3
+	#define LOG3DS_ERROR(message) LOG3DS_WRITE(log3ds::error, message)
+#else
+	#define LOG3DS_ERROR(message) do {} while (false)
+#endif
+
+#endif // _LOG3DS_H_
@@ -0,0 +1,128 @@
+#include "mapping3ds.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile():
+	address(NULL),
+	length(0),
+	mapped(false)
+#ifdef _WIN32
+	, fileHandle(INVALID_HANDLE_VALUE),
+	mappingHandle(NULL)
+#endif
+{}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char *fileName)
+{
+	close();
+
+#ifdef _WIN32
+	fileHandle = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(fileHandle, &fileSize) && fileSize.QuadPart > 0) {
+		mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mappingHandle != NULL)
+			address = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+
+		if (address != NULL) {
+			length = static_cast<size_t>(fileSize.QuadPart);
+			mapped = true;
+			return true;
+		}
+	}
+
+	close();
+#else
+	int fd = ::open(fileName, O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			// the whole file is walked front to back exactly once
+			madvise(p, st.st_size, MADV_SEQUENTIAL);
+			address = p;
+			length = st.st_size;
+			mapped = true;
+		}
+	}
+
+	::close(fd);
+
+	if (mapped)
+		return true;
+#endif
+
+	return readWhole(fileName);
+}
+
+void MappedFile::close()
+{
+	if (mapped) {
+#ifdef _WIN32
+		UnmapViewOfFile(address);
+#else
+		munmap(address, length);
+#endif
+	} else {
+		free(address);
+	}
+
+#ifdef _WIN32
+	if (mappingHandle != NULL)
+		CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(fileHandle);
+
+	mappingHandle = NULL;
+	fileHandle = INVALID_HANDLE_VALUE;
+#endif
+
+	address = NULL;
+	length = 0;
+	mapped = false;
+}
+
+bool MappedFile::readWhole(const char *fileName)
+{
+	FILE *fp = fopen(fileName, "rb");
+	if (fp == NULL)
+		return false;
+
+	fseek(fp, 0, SEEK_END);
+	long int fileSize = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if (fileSize > 0) {
+		address = malloc(fileSize);
+		if (address != NULL && fread(address, 1, fileSize, fp) == static_cast<size_t>(fileSize)) {
+			length = fileSize;
+		} else {
+			free(address);
+			address = NULL;
+		}
+	}
+
+	fclose(fp);
+
+	return address != NULL;
+}
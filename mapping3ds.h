@@ -0,0 +1,33 @@
+#ifndef _MAPPING3DS_H_
+#define _MAPPING3DS_H_
+
+#include <cstdlib>
+
+// Read-only view of a whole file. Uses the OS memory mapping when available
+// and falls back to reading the file into a heap buffer otherwise.
+class MappedFile
+{
+	public:
+		MappedFile();
+		~MappedFile();
+		bool open(const char *fileName);
+		void close();
+
+		const void *data() const { return address; }
+		size_t size() const { return length; }
+
+	private:
+		MappedFile(const MappedFile &);
+		MappedFile &operator =(const MappedFile &);
+
+		bool readWhole(const char *fileName);
+
+		void *address;
+		size_t length;
+		bool mapped;
+#ifdef _WIN32
+		void *fileHandle, *mappingHandle;
+#endif
+};
+
+#endif // _MAPPING3DS_H_
@@ -0,0 +1,391 @@
+#include "mesh3ds.h"
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	// FNV-1a over the bytes, so only identical vertices are merged
+	DWord hash(const CompiledVertex &vertex)
+	{
+		const Byte *p = reinterpret_cast<const Byte *>(&vertex);
+		DWord h = 2166136261u;
+		
+		for (size_t i=0; i<sizeof(vertex); ++i) {
+			h ^= p[i];
+			h *= 16777619u;
+		}
+		
+		return h;
+	}
+}
+
+const void *CompiledMesh::getIndexData() const
+{
+	if (getNumIndices() == 0)
+		return NULL;
+	
+	return wideIndices ? static_cast<const void *>(&longIndices[0]) : static_cast<const void *>(&shortIndices[0]);
+}
+
+void CompiledMesh::setIndices(const vector<DWord> &indices)
+{
+	wideIndices = vertices.size() > 0x10000;
+	
+	if (wideIndices) {
+		longIndices = indices;
+		shortIndices.clear();
+	} else {
+		shortIndices.assign(indices.begin(), indices.end());
+		longIndices.clear();
+	}
+}
+
+void MeshCompiler::begin(CompiledMesh &mesh, size_t maxVertices, size_t numIndices)
+{
+	this->mesh = &mesh;
+	mesh.vertices.clear();
+	mesh.vertices.reserve(maxVertices);
+	mesh.ranges.clear();
+	mesh.hasNormals = mesh.hasMapCoords = false;
+	
+	indices.clear();
+	indices.reserve(numIndices);
+	
+	// keep the load factor under 1/2
+	size_t numSlots = 2;
+	while (numSlots < 2*maxVertices)
+		numSlots *= 2;
+	slots.assign(numSlots, noIndex);
+}
+
+void MeshCompiler::setSource(const Vertex *vertices, const Vector *normals, const MapCoord *mapCoords, size_t numVertices, size_t numMapCoords)
+{
+	this->vertices = vertices;
+	this->normals = normals;
+	this->mapCoords = mapCoords;
+	this->numMapCoords = (mapCoords != NULL ? numMapCoords : 0);
+	
+	mesh->hasNormals = mesh->hasNormals || normals != NULL;
+	mesh->hasMapCoords = mesh->hasMapCoords || mapCoords != NULL;
+	
+	remap.assign(numVertices, noIndex);
+}
+
+void MeshCompiler::addTriangles(DWord material, const Word *indices, size_t numIndices)
+{
+	if (numIndices == 0)
+		return;
+	
+	if (mesh->ranges.empty() || mesh->ranges.back().material != material) {
+		CompiledMesh::Range range;
+		range.material = material;
+		range.firstIndex = this->indices.size();
+		range.numIndices = 0;
+		mesh->ranges.push_back(range);
+	}
+	
+	for (size_t i=0; i<numIndices; ++i) {
+		Word source = indices[i];
+		if (remap[source] == noIndex)
+			remap[source] = addVertex(source);
+		
+		this->indices.push_back(remap[source]);
+	}
+	
+	mesh->ranges.back().numIndices += numIndices;
+}
+
+void MeshCompiler::end()
+{
+	mesh->setIndices(indices);
+	
+	indices.clear();
+	remap.clear();
+	slots.clear();
+}
+
+DWord MeshCompiler::addVertex(Word source)
+{
+	// the hash and the comparison see the bytes, CompiledVertex has no padding
+	CompiledVertex vertex;
+	vertex.mapCoord.u = vertex.mapCoord.v = 0.f;
+	
+	vertex.position = vertices[source];
+	if (normals != NULL)
+		vertex.normal = normals[source];
+	if (source < numMapCoords)
+		vertex.mapCoord = mapCoords[source];
+	
+	size_t mask = slots.size() - 1;
+	size_t slot = hash(vertex) & mask;
+	
+	while (slots[slot] != noIndex) {
+		if (memcmp(&mesh->vertices[slots[slot]], &vertex, sizeof(vertex)) == 0)
+			return slots[slot];
+		
+		slot = (slot + 1) & mask;
+	}
+	
+	DWord index = mesh->vertices.size();
+	slots[slot] = index;
+	mesh->vertices.push_back(vertex);
+	
+	// more vertices than begin() was told of
+	if (mesh->vertices.size()*2 > slots.size())
+		grow();
+	
+	return index;
+}
+
+void MeshCompiler::grow()
+{
+	slots.assign(slots.size()*2, noIndex);
+	size_t mask = slots.size() - 1;
+	
+	for (DWord i=0; i<mesh->vertices.size(); ++i) {
+		size_t slot = hash(mesh->vertices[i]) & mask;
+		while (slots[slot] != noIndex)
+			slot = (slot + 1) & mask;
+		
+		slots[slot] = i;
+	}
+}
+
+void CompiledMesh::getIndices(vector<DWord> &indices) const
+{
+	if (wideIndices)
+		indices = longIndices;
+	else
+		indices.assign(shortIndices.begin(), shortIndices.end());
+}
+
+namespace
+{
+	// Forsyth's scoring
+	const size_t cacheSize = 32;
+	const float cacheDecayPower = 1.5f;
+	const float lastTriangleScore = 0.75f;
+	const float valenceBoostScale = 2.f;
+	const float valenceBoostPower = 0.5f;
+	
+	const DWord maxTabulatedValence = 32;
+	
+	// the two parts of the score of a vertex, computed once
+	struct ScoreTables
+	{
+		ScoreTables()
+		{
+			for (size_t i=0; i<cacheSize; ++i) {
+				// the vertices of the last triangle are scored alike, so it
+				// doesn't matter in which order they were added
+				if (i < 3)
+					cache[i] = lastTriangleScore;
+				else
+					cache[i] = pow(1.f - (i - 3) / static_cast<float>(cacheSize - 3), cacheDecayPower);
+			}
+			
+			for (DWord i=1; i<=maxTabulatedValence; ++i)
+				valence[i] = valenceBoost(i);
+		}
+		
+		static float valenceBoost(DWord remainingTriangles)
+		{
+			return valenceBoostScale * pow(static_cast<float>(remainingTriangles), -valenceBoostPower);
+		}
+		
+		float cache[cacheSize];
+		float valence[maxTabulatedValence + 1];
+	};
+	
+	const ScoreTables tables;
+	
+	float vertexScore(size_t cachePosition, DWord remainingTriangles)
+	{
+		if (remainingTriangles == 0)
+			return -1.f;
+		
+		float score = (cachePosition < cacheSize ? tables.cache[cachePosition] : 0.f);
+		
+		if (remainingTriangles <= maxTabulatedValence)
+			return score + tables.valence[remainingTriangles];
+		return score + ScoreTables::valenceBoost(remainingTriangles);
+	}
+	
+	// Reorders the triangles of indices[first, first + count).
+	void optimizeRange(vector<DWord> &indices, size_t first, size_t count, size_t numVertices)
+	{
+		size_t numTriangles = count / 3;
+		if (numTriangles < 2)
+			return;
+		
+		const DWord *range = &indices[first];
+		
+		// triangles of each vertex
+		vector<DWord> firstTriangle(numVertices + 1, 0);
+		for (size_t i=0; i<3*numTriangles; ++i)
+			++firstTriangle[range[i] + 1];
+		for (size_t v=0; v<numVertices; ++v)
+			firstTriangle[v + 1] += firstTriangle[v];
+		
+		vector<DWord> triangles(3*numTriangles);
+		vector<DWord> remaining(numVertices, 0); // triangles not emitted yet
+		for (size_t i=0; i<3*numTriangles; ++i) {
+			DWord v = range[i];
+			triangles[firstTriangle[v] + remaining[v]++] = i / 3;
+		}
+		
+		vector<float> scores(numVertices);
+		for (size_t i=0; i<3*numTriangles; ++i)
+			scores[range[i]] = vertexScore(cacheSize, remaining[range[i]]);
+		
+		vector<float> triangleScores(numTriangles);
+		for (size_t t=0; t<numTriangles; ++t)
+			triangleScores[t] = scores[range[3*t]] + scores[range[3*t + 1]] + scores[range[3*t + 2]];
+		
+		vector<bool> emitted(numTriangles, false);
+		vector<DWord> output;
+		output.reserve(3*numTriangles);
+		
+		vector<DWord> cache, nextCache;
+		cache.reserve(cacheSize + 3);
+		nextCache.reserve(cacheSize + 3);
+		
+		size_t best = 0;
+		for (size_t t=1; t<numTriangles; ++t) {
+			if (triangleScores[t] > triangleScores[best])
+				best = t;
+		}
+		
+		size_t cursor = 0; // every triangle before it is emitted
+		
+		while (true) {
+			emitted[best] = true;
+			
+			// the triangle's vertices go to the front of the LRU cache
+			nextCache.clear();
+			for (int k=0; k<3; ++k) {
+				DWord v = range[3*best + k];
+				output.push_back(v);
+				if (find(nextCache.begin(), nextCache.end(), v) == nextCache.end())
+					nextCache.push_back(v);
+				
+				// it isn't adjacent to its emitted triangles anymore
+				DWord *begin = &triangles[firstTriangle[v]];
+				DWord *end = begin + remaining[v];
+				*find(begin, end, static_cast<DWord>(best)) = *(end - 1);
+				--remaining[v];
+			}
+			size_t triangleVertices = nextCache.size();
+			for (size_t i=0; i<cache.size(); ++i) {
+				DWord v = cache[i];
+				if (find(nextCache.begin(), nextCache.begin() + triangleVertices, v) == nextCache.begin() + triangleVertices)
+					nextCache.push_back(v);
+			}
+			
+			// rescore the cached vertices and the evicted ones, and their
+			// triangles by the difference
+			for (size_t i=0; i<nextCache.size(); ++i) {
+				DWord v = nextCache[i];
+				float score = vertexScore(i, remaining[v]);
+				float delta = score - scores[v];
+				scores[v] = score;
+				
+				for (DWord j=firstTriangle[v]; j<firstTriangle[v] + remaining[v]; ++j)
+					triangleScores[triangles[j]] += delta;
+			}
+			if (nextCache.size() > cacheSize)
+				nextCache.resize(cacheSize);
+			cache.swap(nextCache);
+			
+			// the next triangle is the best one around the cache
+			float bestScore = -1.f;
+			for (size_t i=0; i<cache.size(); ++i) {
+				DWord v = cache[i];
+				for (DWord j=firstTriangle[v]; j<firstTriangle[v] + remaining[v]; ++j) {
+					DWord t = triangles[j];
+					if (triangleScores[t] > bestScore) {
+						bestScore = triangleScores[t];
+						best = t;
+					}
+				}
+			}
+			
+			// none touches the cache, carry on in the original order
+			if (bestScore < 0.f) {
+				while (cursor < numTriangles && emitted[cursor])
+					++cursor;
+				if (cursor == numTriangles)
+					break;
+				best = cursor;
+			}
+		}
+		
+		copy(output.begin(), output.end(), indices.begin() + first);
+	}
+}
+
+namespace mesh3ds
+{
+	float getACMR(const CompiledMesh &mesh, size_t cacheSize)
+	{
+		size_t numIndices = mesh.getNumIndices();
+		if (numIndices < 3)
+			return 0.f;
+		
+		// FIFO, each vertex remembers when it entered the cache
+		vector<size_t> entered(mesh.vertices.size(), 0);
+		size_t time = 0, misses = 0;
+		
+		for (size_t i=0; i<numIndices; ++i) {
+			DWord v = mesh.getIndex(i);
+			if (entered[v] == 0 || time - entered[v] >= cacheSize) {
+				++misses;
+				++time;
+				entered[v] = time;
+			}
+		}
+		
+		return static_cast<float>(misses) / (numIndices / 3);
+	}
+	
+	void optimizeVertexCache(CompiledMesh &mesh)
+	{
+		vector<DWord> indices;
+		mesh.getIndices(indices);
+		
+		for (size_t i=0; i<mesh.ranges.size(); ++i)
+			optimizeRange(indices, mesh.ranges[i].firstIndex, mesh.ranges[i].numIndices, mesh.vertices.size());
+		
+		mesh.setIndices(indices);
+	}
+	
+	void optimizeVertexFetch(CompiledMesh &mesh)
+	{
+		vector<DWord> indices;
+		mesh.getIndices(indices);
+		
+		vector<DWord> remap(mesh.vertices.size(), noIndex);
+		vector<CompiledVertex> vertices;
+		vertices.reserve(mesh.vertices.size());
+		
+		for (size_t i=0; i<indices.size(); ++i) {
+			DWord &v = indices[i];
+			if (remap[v] == noIndex) {
+				remap[v] = vertices.size();
+				vertices.push_back(mesh.vertices[v]);
+			}
+			v = remap[v];
+		}
+		
+		// vertices no triangle uses stay at the end
+		for (size_t v=0; v<mesh.vertices.size(); ++v) {
+			if (remap[v] == noIndex)
+				vertices.push_back(mesh.vertices[v]);
+		}
+		
+		mesh.vertices.swap(vertices);
+		mesh.setIndices(indices);
+	}
+}
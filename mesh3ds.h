@@ -0,0 +1,100 @@
+#ifndef _MESH3DS_H_
+#define _MESH3DS_H_
+
+#include <cstdlib>
+#include <vector>
+#include <GL/gl.h>
+
+#include "types3ds.h"
+
+using namespace std;
+
+struct CompiledVertex
+{
+	Vertex position;
+	Vector normal;
+	MapCoord mapCoord;
+};
+
+// A mesh as one stream of interleaved vertices and one index list, drawn by
+// ranges of a material each. Indices are 16 bit while the vertices allow it
+// and 32 bit otherwise, e.g. for merged objects.
+class CompiledMesh
+{
+	public:
+		struct Range
+		{
+			DWord material; // index into Model3DS::getMaterials()
+			DWord firstIndex, numIndices;
+		};
+		
+		CompiledMesh(): hasNormals(false), hasMapCoords(false), wideIndices(false) {}
+		
+		vector<CompiledVertex> vertices;
+		vector<Range> ranges;
+		bool hasNormals, hasMapCoords; // otherwise they are zero
+		
+		// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+		GLenum getIndexType() const { return wideIndices ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT; }
+		size_t getIndexSize() const { return wideIndices ? sizeof(DWord) : sizeof(Word); }
+		size_t getNumIndices() const { return wideIndices ? longIndices.size() : shortIndices.size(); }
+		const void *getIndexData() const;
+		DWord getIndex(size_t i) const { return wideIndices ? longIndices[i] : shortIndices[i]; }
+		void getIndices(vector<DWord> &indices) const;
+		// picks the index size for the current vertices
+		void setIndices(const vector<DWord> &indices);
+	
+	private:
+		vector<Word> shortIndices;
+		vector<DWord> longIndices;
+		bool wideIndices;
+};
+
+// Builds a CompiledMesh from the triangles of one or more objects. Only the
+// vertices the triangles use are kept, in the order they are first used, and
+// vertices equal in position, normal and map coords are stored once.
+class MeshCompiler
+{
+	public:
+		// maxVertices bounds the vertices of all the objects to be added,
+		// numIndices is the expected number of indices
+		void begin(CompiledMesh &mesh, size_t maxVertices, size_t numIndices = 0);
+		// the arrays of the object whose triangles are added next, normals and
+		// mapCoords may be NULL
+		void setSource(const Vertex *vertices, const Vector *normals, const MapCoord *mapCoords, size_t numVertices, size_t numMapCoords);
+		// Adds a triangle list of the current object. Consecutive lists of
+		// the same material share a range.
+		void addTriangles(DWord material, const Word *indices, size_t numIndices);
+		void end();
+	
+	private:
+		DWord addVertex(Word source);
+		void grow();
+		
+		CompiledMesh *mesh;
+		const Vertex *vertices;
+		const Vector *normals;
+		const MapCoord *mapCoords;
+		size_t numMapCoords;
+		
+		vector<DWord> indices;
+		vector<DWord> remap; // compiled vertex of each vertex of the source
+		vector<DWord> slots; // open addressing on the compiled vertices
+};
+
+// Reordering of compiled meshes for the GPU, e.g. once at load or bake time.
+namespace mesh3ds
+{
+	// Average cache miss ratio: vertices transformed per triangle with a
+	// FIFO post-transform cache of cacheSize entries, 0.5 at best and 3 at
+	// worst.
+	float getACMR(const CompiledMesh &mesh, size_t cacheSize = 16);
+	// Reorders the triangles of each range for the post-transform vertex
+	// cache, with Tom Forsyth's linear-speed vertex cache optimisation.
+	void optimizeVertexCache(CompiledMesh &mesh);
+	// Renumbers the vertices in the order the triangles first use them, so
+	// fetching them walks memory forwards.
+	void optimizeVertexFetch(CompiledMesh &mesh);
+}
+
+#endif // _MESH3DS_H_
@@ -0,0 +1,412 @@
+#include "normals3ds.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if !defined(OPEN3DS_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+	#define NORMALS3DS_SIMD
+	#define NORMALS3DS_TARGET(isa) __attribute__((target(isa)))
+	#include <immintrin.h>
+#elif !defined(OPEN3DS_NO_SIMD) && defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	#define NORMALS3DS_SIMD
+	#define NORMALS3DS_TARGET(isa)
+	#include <intrin.h>
+	#include <immintrin.h>
+#endif
+
+namespace
+{
+	using namespace normals3ds;
+
+	// How accumulateScalar() reaches the vertices and normals of either layout.
+	struct Interleaved
+	{
+		Interleaved(const Vertex *vertices, Vector *normals): vertices(vertices), normals(normals) {}
+
+		GLfloat x(Word i) const { return vertices[i].x; }
+		GLfloat y(Word i) const { return vertices[i].y; }
+		GLfloat z(Word i) const { return vertices[i].z; }
+
+		void add(Word i, GLfloat x, GLfloat y, GLfloat z) const
+		{
+			normals[i] += Vector(x, y, z);
+		}
+
+		const Vertex *vertices;
+		Vector *normals;
+	};
+
+	struct Separate
+	{
+		Separate(const VertexArrays &vertices, const VertexArrays &normals): vertices(vertices), normals(normals) {}
+
+		GLfloat x(Word i) const { return vertices.x[i]; }
+		GLfloat y(Word i) const { return vertices.y[i]; }
+		GLfloat z(Word i) const { return vertices.z[i]; }
+
+		void add(Word i, GLfloat x, GLfloat y, GLfloat z) const
+		{
+			normals.x[i] += x;
+			normals.y[i] += y;
+			normals.z[i] += z;
+		}
+
+		const VertexArrays &vertices, &normals;
+	};
+
+	template <typename Arrays>
+	void accumulateScalar(const Arrays &arrays, const Face *faces, size_t numFaces)
+	{
+		for (size_t i=0; i<numFaces; ++i) {
+			const Face &face = faces[i];
+
+			Vector a(arrays.x(face.vertexA), arrays.y(face.vertexA), arrays.z(face.vertexA));
+			Vector b(arrays.x(face.vertexB), arrays.y(face.vertexB), arrays.z(face.vertexB));
+			Vector c(arrays.x(face.vertexC), arrays.y(face.vertexC), arrays.z(face.vertexC));
+
+			Vector normal = (b - a) * (c - b);
+
+			arrays.add(face.vertexA, normal.x, normal.y, normal.z);
+			arrays.add(face.vertexB, normal.x, normal.y, normal.z);
+			arrays.add(face.vertexC, normal.x, normal.y, normal.z);
+		}
+	}
+
+	void normalizeScalar(Vector *normals, size_t numNormals)
+	{
+		for (size_t i=0; i<numNormals; ++i)
+			normals[i].normalize();
+	}
+
+	void normalizeScalar(const VertexArrays &normals, size_t first, size_t numNormals)
+	{
+		for (size_t i=first; i<numNormals; ++i) {
+			Vector normal(normals.x[i], normals.y[i], normals.z[i]);
+			normal.normalize();
+
+			normals.x[i] = normal.x;
+			normals.y[i] = normal.y;
+			normals.z[i] = normal.z;
+		}
+	}
+
+#ifdef NORMALS3DS_SIMD
+	// Four interleaved normals are loaded as three registers and transposed
+	// to x, y and z; the lengths are spread back over the interleaved layout
+	// for the division.
+	NORMALS3DS_TARGET("sse2")
+	void normalizeSSE(Vector *normals, size_t numNormals)
+	{
+		GLfloat *p = &normals[0].x;
+		size_t i = 0;
+
+		for (; i+4 <= numNormals; i+=4, p+=12) {
+			__m128 m0 = _mm_loadu_ps(p);     // x0 y0 z0 x1
+			__m128 m1 = _mm_loadu_ps(p + 4); // y1 z1 x2 y2
+			__m128 m2 = _mm_loadu_ps(p + 8); // z2 x3 y3 z3
+
+			__m128 x = _mm_shuffle_ps(m0, _mm_shuffle_ps(m1, m2, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+			__m128 y = _mm_shuffle_ps(_mm_shuffle_ps(m0, m1, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(m1, m2, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 z = _mm_shuffle_ps(_mm_shuffle_ps(m0, m1, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(m2, m2, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+
+			_mm_storeu_ps(p, _mm_div_ps(m0, _mm_shuffle_ps(length, length, _MM_SHUFFLE(1, 0, 0, 0))));
+			_mm_storeu_ps(p + 4, _mm_div_ps(m1, _mm_shuffle_ps(length, length, _MM_SHUFFLE(2, 2, 1, 1))));
+			_mm_storeu_ps(p + 8, _mm_div_ps(m2, _mm_shuffle_ps(length, length, _MM_SHUFFLE(3, 3, 3, 2))));
+		}
+
+		normalizeScalar(normals + i, numNormals - i);
+	}
+
+	NORMALS3DS_TARGET("sse2")
+	void normalizeSSE(const VertexArrays &normals, size_t numNormals)
+	{
+		size_t i = 0;
+
+		for (; i+4 <= numNormals; i+=4) {
+			__m128 x = _mm_loadu_ps(normals.x + i);
+			__m128 y = _mm_loadu_ps(normals.y + i);
+			__m128 z = _mm_loadu_ps(normals.z + i);
+
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+
+			_mm_storeu_ps(normals.x + i, _mm_div_ps(x, length));
+			_mm_storeu_ps(normals.y + i, _mm_div_ps(y, length));
+			_mm_storeu_ps(normals.z + i, _mm_div_ps(z, length));
+		}
+
+		normalizeScalar(normals, i, numNormals);
+	}
+
+	NORMALS3DS_TARGET("avx")
+	void normalizeAVX(const VertexArrays &normals, size_t numNormals)
+	{
+		size_t i = 0;
+
+		for (; i+8 <= numNormals; i+=8) {
+			__m256 x = _mm256_loadu_ps(normals.x + i);
+			__m256 y = _mm256_loadu_ps(normals.y + i);
+			__m256 z = _mm256_loadu_ps(normals.z + i);
+
+			__m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)));
+
+			_mm256_storeu_ps(normals.x + i, _mm256_div_ps(x, length));
+			_mm256_storeu_ps(normals.y + i, _mm256_div_ps(y, length));
+			_mm256_storeu_ps(normals.z + i, _mm256_div_ps(z, length));
+		}
+
+		// dirty upper halves would slow down the SSE code that follows
+		_mm256_zeroupper();
+		normalizeScalar(normals, i, numNormals);
+	}
+
+	Kernel detectKernel()
+	{
+	#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		if (osxsave && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6)
+			return avx;
+		if ((info[3] & (1 << 26)) != 0)
+			return sse;
+	#else
+		// also checks that the OS saves the AVX registers
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx"))
+			return avx;
+		if (__builtin_cpu_supports("sse2"))
+			return sse;
+	#endif
+		return scalar;
+	}
+#else
+	Kernel detectKernel()
+	{
+		return scalar;
+	}
+#endif
+
+	const Kernel bestKernel = detectKernel();
+	Kernel kernel = bestKernel;
+}
+
+namespace normals3ds
+{
+	Kernel getKernel()
+	{
+		return kernel;
+	}
+
+	bool setKernel(Kernel selected)
+	{
+		if (!isSupported(selected))
+			return false;
+
+		kernel = selected;
+		return true;
+	}
+
+	bool isSupported(Kernel kernel)
+	{
+		return kernel <= bestKernel;
+	}
+
+	const char *getKernelName(Kernel kernel)
+	{
+		static const char *names[] = {"scalar", "sse", "avx"};
+		return kernel < numKernels ? names[kernel] : "";
+	}
+
+	void accumulate(const Vertex *vertices, const Face *faces, size_t numFaces, Vector *normals)
+	{
+		accumulateScalar(Interleaved(vertices, normals), faces, numFaces);
+	}
+
+	void accumulate(const VertexArrays &vertices, const Face *faces, size_t numFaces, const VertexArrays &normals)
+	{
+		accumulateScalar(Separate(vertices, normals), faces, numFaces);
+	}
+
+	void normalize(Vector *normals, size_t numNormals)
+	{
+		switch (kernel) {
+	#ifdef NORMALS3DS_SIMD
+			// 256 bit registers don't help the interleaved transpose
+			case avx:
+			case sse: normalizeSSE(normals, numNormals); break;
+	#endif
+			default: normalizeScalar(normals, numNormals);
+		}
+	}
+
+	void normalize(const VertexArrays &normals, size_t numNormals)
+	{
+		switch (kernel) {
+	#ifdef NORMALS3DS_SIMD
+			case avx: normalizeAVX(normals, numNormals); break;
+			case sse: normalizeSSE(normals, numNormals); break;
+	#endif
+			default: normalizeScalar(normals, 0, numNormals);
+		}
+	}
+}
+
+namespace
+{
+	const DWord allGroups = 0xFFFFFFFF;
+	const DWord noCorner = 0xFFFFFFFF;
+	const GLfloat pi = 3.14159265f;
+}
+
+namespace normals3ds
+{
+	void MeshNormals::begin(const Vertex *vertices, Word numVertices, const Face *faces, size_t numFaces, const DWord *smoothingGroups, Weighting weighting)
+	{
+		this->vertices = vertices;
+		this->numVertices = numVertices;
+		this->faces = faces;
+		this->numFaces = numFaces;
+		this->smoothingGroups = smoothingGroups;
+		this->weighting = weighting;
+		smoothing = false;
+
+		contributions.resize(3*numFaces);
+	}
+
+	void MeshNormals::computeCorners(size_t firstFace, size_t lastFace)
+	{
+		for (size_t i=firstFace; i<lastFace; ++i) {
+			const Vertex &a = vertices[faces[i].vertexA];
+			const Vertex &b = vertices[faces[i].vertexB];
+			const Vertex &c = vertices[faces[i].vertexC];
+
+			// the same product as accumulate(), its length is twice the area
+			Vector normal = (b - a) * (c - b);
+			Vector *corner = &contributions[3*i];
+
+			if (weighting == areaWeighted) {
+				corner[0] = corner[1] = corner[2] = normal;
+				continue;
+			}
+
+			GLfloat length = normal.length();
+			if (length == 0.f) {
+				corner[0] = corner[1] = corner[2] = Vector();
+				continue;
+			}
+
+			// the cross product of the edges of any corner is as long as the
+			// normal, and the angles of a triangle add up to pi
+			GLfloat angleA = atan2(length, (b - a).dotProduct(c - a));
+			GLfloat angleB = atan2(length, (c - b).dotProduct(a - b));
+			GLfloat angleC = max(pi - angleA - angleB, 0.f);
+
+			normal = normal * (1.f / length);
+			corner[0] = normal * angleA;
+			corner[1] = normal * angleB;
+			corner[2] = normal * angleC;
+		}
+	}
+
+	size_t MeshNormals::link(bool smoothing)
+	{
+		this->smoothing = smoothing && smoothingGroups != NULL;
+
+		// corners of each vertex, a counting sort keeps them in face order
+		firstCorner.assign(numVertices + 1, 0);
+		for (size_t i=0; i<numFaces; ++i) {
+			++firstCorner[faces[i].vertexA + 1];
+			++firstCorner[faces[i].vertexB + 1];
+			++firstCorner[faces[i].vertexC + 1];
+		}
+		for (Word v=0; v<numVertices; ++v)
+			firstCorner[v + 1] += firstCorner[v];
+
+		corners.resize(3*numFaces);
+		vector<DWord> next(firstCorner.begin(), firstCorner.end() - 1);
+		for (size_t i=0; i<numFaces; ++i) {
+			corners[next[faces[i].vertexA]++] = 3*i;
+			corners[next[faces[i].vertexB]++] = 3*i + 1;
+			corners[next[faces[i].vertexC]++] = 3*i + 2;
+		}
+
+		// each vertex keeps its index for the first mask around it, the
+		// vertices split off for other masks are appended
+		sources.resize(numVertices);
+		masks.assign(numVertices, allGroups);
+		owners.assign(numVertices, noCorner);
+		cornerVertices.resize(3*numFaces);
+
+		for (Word v=0; v<numVertices; ++v) {
+			sources[v] = v;
+
+			size_t firstSplit = sources.size();
+			bool used = false;
+
+			for (DWord j=firstCorner[v]; j<firstCorner[v + 1]; ++j) {
+				DWord corner = corners[j];
+				DWord mask = this->smoothing ? smoothingGroups[corner / 3] : allGroups;
+				size_t vertex = sources.size();
+
+				if (mask != 0) {
+					if (used && masks[v] == mask)
+						vertex = v;
+					for (size_t k=firstSplit; k<sources.size() && vertex == sources.size(); ++k) {
+						if (masks[k] == mask)
+							vertex = k;
+					}
+				}
+
+				if (vertex == sources.size()) {
+					if (!used) {
+						vertex = v;
+						used = true;
+					} else {
+						sources.push_back(v);
+						masks.push_back(0);
+						owners.push_back(noCorner);
+					}
+
+					masks[vertex] = mask;
+					owners[vertex] = corner;
+				}
+
+				cornerVertices[corner] = vertex;
+			}
+		}
+
+		return sources.size();
+	}
+
+	void MeshNormals::remapFaces(Face *faces) const
+	{
+		for (size_t i=0; i<numFaces; ++i) {
+			faces[i].vertexA = cornerVertices[3*i];
+			faces[i].vertexB = cornerVertices[3*i + 1];
+			faces[i].vertexC = cornerVertices[3*i + 2];
+		}
+	}
+
+	void MeshNormals::gather(Vector *normals, size_t first, size_t last) const
+	{
+		for (size_t vertex=first; vertex<last; ++vertex) {
+			Word source = sources[vertex];
+			DWord mask = masks[vertex];
+			Vector normal;
+
+			for (DWord j=firstCorner[source]; j<firstCorner[source + 1]; ++j) {
+				DWord corner = corners[j];
+
+				if (mask == 0 ? corner == owners[vertex] : !smoothing || (smoothingGroups[corner / 3] & mask) != 0)
+					normal += contributions[corner];
+			}
+
+			normals[vertex] = normal;
+		}
+
+		normalize(normals + first, last - first);
+	}
+}
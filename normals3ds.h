@@ -0,0 +1,81 @@
+#ifndef _NORMALS3DS_H_
+#define _NORMALS3DS_H_
+
+#include <cstdlib>
+#include <vector>
+#include <GL/gl.h>
+
+#include "types3ds.h"
+
+using namespace std;
+
+// Vertex normal kernels. The SSE and AVX versions give the same results as
+// the scalar one, which uses the Vector operators; the best one the CPU
+// supports is picked at run time unless OPEN3DS_NO_SIMD is defined.
+//
+// Only normalization is vectorized. Accumulation is bound by gathering the
+// indexed vertices and scattering into the normals, and SIMD face normals
+// measured no faster, so every kernel accumulates with scalar code.
+namespace normals3ds
+{
+	enum Kernel { scalar, sse, avx, numKernels };
+	
+	Kernel getKernel();
+	// Selects a kernel, e.g. to compare them. Returns false if the CPU or
+	// the build doesn't support it.
+	bool setKernel(Kernel kernel);
+	bool isSupported(Kernel kernel);
+	const char *getKernelName(Kernel kernel);
+	
+	// Adds the (area weighted) normal of each face to its three vertices.
+	void accumulate(const Vertex *vertices, const Face *faces, size_t numFaces, Vector *normals);
+	void accumulate(const VertexArrays &vertices, const Face *faces, size_t numFaces, const VertexArrays &normals);
+	
+	void normalize(Vector *normals, size_t numNormals);
+	void normalize(const VertexArrays &normals, size_t numNormals);
+	
+	enum Weighting { areaWeighted, angleWeighted };
+	
+	// Normals of one mesh built from its vertex to face adjacency, for
+	// angle weighting, smoothing groups and splitting a mesh over threads.
+	// The steps run in order; computeCorners() and gather() can run on
+	// disjoint ranges at the same time. Area weighted normals without
+	// smoothing groups come out exactly as with accumulate().
+	//
+	// Faces sharing a bit of their smoothing group mask are smoothed
+	// together and faces without any bit are flat, so a vertex is split in
+	// as many vertices as there are different masks around it.
+	class MeshNormals
+	{
+		public:
+			void begin(const Vertex *vertices, Word numVertices, const Face *faces, size_t numFaces, const DWord *smoothingGroups, Weighting weighting);
+			// the contribution of each face to its corners
+			void computeCorners(size_t firstFace, size_t lastFace);
+			// Returns the number of vertices after splitting them by
+			// smoothing groups, or without splitting if smoothing is false.
+			size_t link(bool smoothing);
+			// the original vertex of a vertex returned by link()
+			Word getSource(size_t vertex) const { return sources[vertex]; }
+			// points the faces to the split vertices
+			void remapFaces(Face *faces) const;
+			// sums and normalizes the normals of a range of split vertices
+			void gather(Vector *normals, size_t first, size_t last) const;
+		
+		private:
+			const Vertex *vertices;
+			const Face *faces;
+			const DWord *smoothingGroups;
+			Word numVertices;
+			size_t numFaces;
+			Weighting weighting;
+			bool smoothing;
+			
+			vector<Vector> contributions; // by corner, 3*face + 0, 1 or 2
+			vector<DWord> firstCorner, corners; // corners of each vertex in face order
+			vector<Word> sources; // by split vertex
+			vector<DWord> masks, owners; // by split vertex, owner is the corner of a flat one
+			vector<DWord> cornerVertices; // split vertex of each corner
+	};
+}
+
+#endif // _NORMALS3DS_H_
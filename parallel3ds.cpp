@@ -0,0 +1,73 @@
+#include "parallel3ds.h"
+
+#include <vector>
+#include <algorithm>
+#include <SFML/System.hpp>
+
+using namespace std;
+
+namespace
+{
+	struct Ranges
+	{
+		size_t count, grain, next;
+		parallel3ds::RangeFunction function;
+		void *context;
+		sf::Mutex mutex;
+	};
+	
+	void work(void *userData)
+	{
+		Ranges &ranges = *static_cast<Ranges *>(userData);
+		
+		while (true) {
+			size_t begin;
+			{
+				sf::Lock lock(ranges.mutex);
+				begin = ranges.next;
+				ranges.next = min(ranges.next + ranges.grain, ranges.count);
+			}
+			
+			if (begin == ranges.count)
+				return;
+			
+			ranges.function(ranges.context, begin, min(begin + ranges.grain, ranges.count));
+		}
+	}
+}
+
+namespace parallel3ds
+{
+	void forEachRange(size_t count, size_t grain, RangeFunction function, void *context, unsigned int numThreads)
+	{
+		grain = max(grain, static_cast<size_t>(1));
+		size_t numRanges = (count + grain - 1) / grain;
+		
+		if (numThreads <= 1 || numRanges <= 1) {
+			for (size_t begin=0; begin<count; begin+=grain)
+				function(context, begin, min(begin + grain, count));
+			return;
+		}
+		
+		Ranges ranges;
+		ranges.count = count;
+		ranges.grain = grain;
+		ranges.next = 0;
+		ranges.function = function;
+		ranges.context = context;
+		
+		// the calling thread takes ranges too
+		vector<sf::Thread *> threads(min(static_cast<size_t>(numThreads), numRanges) - 1);
+		for (size_t i=0; i<threads.size(); ++i) {
+			threads[i] = new sf::Thread(work, &ranges);
+			threads[i]->Launch();
+		}
+		
+		work(&ranges);
+		
+		for (size_t i=0; i<threads.size(); ++i) {
+			threads[i]->Wait();
+			delete threads[i];
+		}
+	}
+}
@@ -0,0 +1,16 @@
+#ifndef _PARALLEL3DS_H_
+#define _PARALLEL3DS_H_
+
+#include <cstdlib>
+
+namespace parallel3ds
+{
+	typedef void (*RangeFunction)(void *context, size_t begin, size_t end);
+	
+	// Calls function on consecutive ranges of up to grain items covering
+	// [0, count), on up to numThreads threads including the calling one, and
+	// returns once all of them are done. function must not throw.
+	void forEachRange(size_t count, size_t grain, RangeFunction function, void *context, unsigned int numThreads);
+}
+
+#endif // _PARALLEL3DS_H_
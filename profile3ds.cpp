@@ -0,0 +1,38 @@
+#include "profile3ds.h"
+
+void LoadStats::writeJson(ostream &out) const
+{
+	out << "{\"phases\": {";
+
+	for (int i=0; i<numPhases; ++i) {
+		const Entry &entry = phases[i];
+
+		out << (i == 0 ? "" : ", ") << '"' << getPhaseName(static_cast<Phase>(i)) << "\": {"
+			<< "\"seconds\": " << entry.seconds << ", "
+			<< "\"bytes\": " << entry.bytes << ", "
+			<< "\"count\": " << entry.count << '}';
+	}
+
+	out << "}, \"allocations\": " << allocations << ", \"allocatedBytes\": " << allocatedBytes << '}';
+}
+
+const char *LoadStats::getPhaseName(Phase phase)
+{
+	switch (phase) {
+		case parse: return "parse";
+		case vertices: return "vertices";
+		case faces: return "faces";
+		case faceMaterials: return "faceMaterials";
+		case mapCoords: return "mapCoords";
+		case normals: return "normals";
+		case bvhs: return "bvhs";
+		case materials: return "materials";
+		case keyframer: return "keyframer";
+		case skipped: return "skipped";
+		case textureDecode: return "textureDecode";
+		case mipBuild: return "mipBuild";
+		case textureUpload: return "textureUpload";
+		case bufferUpload: return "bufferUpload";
+		default: return "unknown";
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef _PROFILE3DS_H_
+#define _PROFILE3DS_H_
+
+#include <cstdlib>
+#include <ostream>
+#include <SFML/System.hpp>
+
+using namespace std;
+
+// Where the time of a load goes. Collected only when the library is built
+// with OPEN3DS_PROFILE defined and profiling is enabled on the model;
+// otherwise the PROFILE3DS_* macros expand to nothing.
+struct LoadStats
+{
+	enum Phase
+	{
+		parse,
+		vertices,       // MESH_VERTICES
+		faces,          // MESH_FACES
+		faceMaterials,  // FACES_MATERIALS
+		mapCoords,      // MESH_MAPCOORDS
+		normals,        // the vertex normals, after the chunks
+		bvhs,           // Model3DS::buildBVHs()
+		materials,      // EDIT_MATERIAL
+		keyframer,      // KEYFRAMER
+		skipped,        // chunks the parser doesn't know
+		textureDecode,
+		mipBuild,
+		textureUpload,
+		bufferUpload,
+		numPhases
+	};
+
+	struct Entry
+	{
+		Entry(): seconds(0.0), bytes(0), count(0) {}
+
+		double seconds;
+		size_t bytes, count;
+	};
+
+	LoadStats(): allocations(0), allocatedBytes(0) {}
+
+	void add(Phase phase, double seconds, size_t bytes)
+	{
+		phases[phase].seconds += seconds;
+		phases[phase].bytes += bytes;
+		++phases[phase].count;
+	}
+
+	void writeJson(ostream &out) const;
+	static const char *getPhaseName(Phase phase);
+
+	Entry phases[numPhases];
+	size_t allocations, allocatedBytes;
+};
+
+// Adds the time until the end of the scope to a phase, if stats isn't NULL.
+class ScopedTimer3DS
+{
+	public:
+		ScopedTimer3DS(LoadStats *stats, LoadStats::Phase phase, size_t bytes): stats(stats), phase(phase), bytes(bytes) {}
+		~ScopedTimer3DS()
+		{
+			if (stats != NULL)
+				stats->add(phase, clock.GetElapsedTime(), bytes);
+		}
+
+	private:
+		LoadStats *stats;
+		LoadStats::Phase phase;
+		size_t bytes;
+		sf::Clock clock;
+};
+
+#ifdef OPEN3DS_PROFILE
+	#define PROFILE3DS_JOIN(a, b) a##b
+	#define PROFILE3DS_NAME(line) PROFILE3DS_JOIN(profileTimer, line)
+	#define PROFILE3DS_SCOPE(stats, phase, bytes) ScopedTimer3DS PROFILE3DS_NAME(__LINE__)(stats, phase, bytes)
+	#define PROFILE3DS_ADD(stats, phase, seconds, bytes) \
+		do { \
+			if ((stats) != NULL) \
+				(stats)->add(phase, seconds, bytes); \
+		} while (false)
+	#define PROFILE3DS_ALLOC(stats, size) \
+		do { \
+			if ((stats) != NULL) { \
+				++(stats)->allocations; \
+				(stats)->allocatedBytes += (size); \
+			} \
+		} while (false)
+#else
+	#define PROFILE3DS_SCOPE(stats, phase, bytes)
+	#define PROFILE3DS_ADD(stats, phase, seconds, bytes) do {} while (false)
+	#define PROFILE3DS_ALLOC(stats, size) do {} while (false)
+#endif
+
+#endif // _PROFILE3DS_H_
@@ -0,0 +1,90 @@
+#include "ray3ds.h"
+
+#include <cmath>
+
+Vector ray3ds::invert(const Vector &direction)
+{
+	return Vector(1.f / direction.x, 1.f / direction.y, 1.f / direction.z);
+}
+
+bool ray3ds::intersectBox(const Vector &origin, const Vector &inverseDirection, const BoundingBox &box, GLfloat maxDistance, GLfloat *distance)
+{
+	if (box.isEmpty())
+		return false;
+
+	const GLfloat o[3] = {origin.x, origin.y, origin.z};
+	const GLfloat d[3] = {inverseDirection.x, inverseDirection.y, inverseDirection.z};
+	const GLfloat lower[3] = {box.lower.x, box.lower.y, box.lower.z};
+	const GLfloat upper[3] = {box.upper.x, box.upper.y, box.upper.z};
+
+	GLfloat enter = 0.f, leave = maxDistance;
+	for (int i=0; i<3; ++i) {
+		GLfloat a = (lower[i] - o[i]) * d[i];
+		GLfloat b = (upper[i] - o[i]) * d[i];
+		// a parallel ray on a slab's plane gives NaN, which the comparisons
+		// ignore so the slab doesn't reject it
+		if (a > b) {
+			GLfloat t = a;
+			a = b;
+			b = t;
+		}
+		if (a > enter)
+			enter = a;
+		if (b < leave)
+			leave = b;
+		if (enter > leave)
+			return false;
+	}
+
+	if (distance != NULL)
+		*distance = enter;
+	return true;
+}
+
+bool ray3ds::intersectTriangle(const Vector &origin, const Vector &direction, const Vector &a, const Vector &b, const Vector &c, GLfloat &distance, GLfloat &u, GLfloat &v)
+{
+	Vector ab = b - a, ac = c - a;
+	Vector p = direction * ac;
+	GLfloat determinant = ab.dotProduct(p);
+	// parallel to the triangle, or a degenerate one
+	if (determinant == 0.f)
+		return false;
+
+	GLfloat inverse = 1.f / determinant;
+	Vector s = origin - a;
+	GLfloat hitU = s.dotProduct(p) * inverse;
+	if (hitU < 0.f || hitU > 1.f)
+		return false;
+
+	Vector q = s * ab;
+	GLfloat hitV = direction.dotProduct(q) * inverse;
+	if (hitV < 0.f || hitU + hitV > 1.f)
+		return false;
+
+	GLfloat t = ac.dotProduct(q) * inverse;
+	if (t < 0.f || !(t < distance))
+		return false;
+
+	distance = t;
+	u = hitU;
+	v = hitV;
+	return true;
+}
+
+bool ray3ds::intersectFaces(const Vector &origin, const Vector &direction, const Vertex *vertices, Word numVertices, const Face *faces, Word numFaces, RayHit &hit)
+{
+	bool found = false;
+
+	for (Word i=0; i<numFaces; ++i) {
+		const Face &face = faces[i];
+		if (face.vertexA >= numVertices || face.vertexB >= numVertices || face.vertexC >= numVertices)
+			continue;
+
+		if (intersectTriangle(origin, direction, vertices[face.vertexA], vertices[face.vertexB], vertices[face.vertexC], hit.distance, hit.u, hit.v)) {
+			hit.face = i;
+			found = true;
+		}
+	}
+
+	return found;
+}
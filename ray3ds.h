@@ -0,0 +1,30 @@
+#ifndef _RAY3DS_H_
+#define _RAY3DS_H_
+
+#include <cstdlib>
+#include <GL/gl.h>
+
+#include "types3ds.h"
+
+// Intersection tests of rays, origin + t*direction for t >= 0. The direction
+// needn't be unit length and t is measured in lengths of it, so the hits of
+// a ray transformed by an affine matrix stay comparable.
+namespace ray3ds
+{
+	// componentwise 1/direction, with infinities for zeros
+	Vector invert(const Vector &direction);
+
+	// Whether the ray enters box before maxDistance (slab test), and where.
+	bool intersectBox(const Vector &origin, const Vector &inverseDirection, const BoundingBox &box, GLfloat maxDistance, GLfloat *distance = NULL);
+
+	// Möller and Trumbore, both sides of the triangle. Returns false unless
+	// it is hit closer than distance, which then becomes the hit's, with u
+	// and v the weights of b and c.
+	bool intersectTriangle(const Vector &origin, const Vector &direction, const Vector &a, const Vector &b, const Vector &c, GLfloat &distance, GLfloat &u, GLfloat &v);
+
+	// The closest of the faces, skipping those with vertices out of range.
+	// Fills the face, distance, u and v of hit if closer than its distance.
+	bool intersectFaces(const Vector &origin, const Vector &direction, const Vertex *vertices, Word numVertices, const Face *faces, Word numFaces, RayHit &hit);
+}
+
+#endif // _RAY3DS_H_
@@ -0,0 +1,150 @@
+#include "stream3ds.h"
+
+#include <algorithm>
+
+using namespace std;
+
+size_t Stream3DS::discard(size_t size)
+{
+	size_t n = 0;
+
+	while (n < size && refill()) {
+		size_t step = min(size - n, static_cast<size_t>(end - cursor));
+		cursor += step;
+		n += step;
+	}
+
+	return n;
+}
+
+size_t Stream3DS::readString(const char *&text, size_t &length, string &scratch)
+{
+	const Byte *terminator = (cursor != end ? static_cast<const Byte *>(memchr(cursor, '\0', end - cursor)) : NULL);
+
+	// the common case, the whole string is in the window
+	if (terminator != NULL) {
+		text = reinterpret_cast<const char *>(cursor);
+		length = terminator - cursor;
+		cursor = terminator + 1;
+		return length + 1;
+	}
+
+	scratch.clear();
+	size_t n = 0;
+
+	while (cursor != end || refill()) {
+		terminator = static_cast<const Byte *>(memchr(cursor, '\0', end - cursor));
+		const Byte *stop = (terminator != NULL ? terminator : end);
+
+		scratch.append(reinterpret_cast<const char *>(cursor), stop - cursor);
+		n += stop - cursor;
+		cursor = stop;
+
+		if (terminator != NULL) {
+			++cursor;
+			++n;
+			break;
+		}
+	}
+
+	text = scratch.data();
+	length = scratch.size();
+	return n;
+}
+
+size_t Stream3DS::readSlow(void *buffer, size_t size)
+{
+	Byte *out = static_cast<Byte *>(buffer);
+	size_t n = 0;
+
+	while (n < size) {
+		if (cursor == end && !refill())
+			break;
+
+		size_t step = min(size - n, static_cast<size_t>(end - cursor));
+		memcpy(out + n, cursor, step);
+		cursor += step;
+		n += step;
+	}
+
+	return n;
+}
+
+size_t Stream3DS::skipSlow(size_t size)
+{
+	size_t n = end - cursor;
+	cursor = end;
+
+	return n + discard(size - n);
+}
+
+MemoryStream3DS::MemoryStream3DS(const void *data, size_t size)
+{
+	cursor = static_cast<const Byte *>(data);
+	end = cursor + size;
+}
+
+FileStream3DS::FileStream3DS(FILE *fp, size_t bufferSize):
+	fp(fp),
+	buffer(new Byte[bufferSize]),
+	bufferSize(bufferSize)
+{}
+
+FileStream3DS::~FileStream3DS()
+{
+	// the read ahead bytes go back to the FILE
+	if (cursor != end)
+		fseek(fp, -static_cast<long>(end - cursor), SEEK_CUR);
+
+	delete [] buffer;
+}
+
+bool FileStream3DS::refill()
+{
+	size_t n = fread(buffer, 1, bufferSize, fp);
+
+	cursor = buffer;
+	end = buffer + n;
+
+	return n != 0;
+}
+
+size_t FileStream3DS::discard(size_t size)
+{
+	// pipes and the like can't seek, fall back to reading
+	if (fseek(fp, size, SEEK_CUR) != 0)
+		return Stream3DS::discard(size);
+
+	return size;
+}
+
+CallbackStream3DS::CallbackStream3DS(ReadCallback readCallback, SkipCallback skipCallback, void *userData, size_t bufferSize):
+	readCallback(readCallback),
+	skipCallback(skipCallback),
+	userData(userData),
+	buffer(new Byte[bufferSize]),
+	bufferSize(bufferSize)
+{}
+
+CallbackStream3DS::~CallbackStream3DS()
+{
+	delete [] buffer;
+}
+
+bool CallbackStream3DS::refill()
+{
+	size_t n = readCallback(userData, buffer, bufferSize);
+
+	cursor = buffer;
+	end = buffer + n;
+
+	return n != 0;
+}
+
+size_t CallbackStream3DS::discard(size_t size)
+{
+	if (skipCallback == NULL)
+		return Stream3DS::discard(size);
+
+	return skipCallback(userData, size);
+}
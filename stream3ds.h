@@ -0,0 +1,119 @@
+#ifndef _STREAM3DS_H_
+#define _STREAM3DS_H_
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <GL/gl.h>
+
+#include "types3ds.h"
+
+// Source of 3DS data. The parser consumes it through a window of buffered
+// bytes [cursor, end) which backends refill on demand, so small reads are an
+// inline memcpy no matter where the data comes from.
+class Stream3DS
+{
+	public:
+		Stream3DS(): cursor(NULL), end(NULL) {}
+		virtual ~Stream3DS() {}
+
+		size_t read(void *buffer, size_t size)
+		{
+			if (static_cast<size_t>(end - cursor) < size)
+				return readSlow(buffer, size);
+
+			memcpy(buffer, cursor, size);
+			cursor += size;
+			return size;
+		}
+
+		// Reads a NUL terminated string in a single pass. text points to its
+		// characters, which stay valid until the next read, and length doesn't
+		// count the NUL. A string split by a refill is gathered in scratch.
+		// Returns the number of bytes consumed.
+		size_t readString(const char *&text, size_t &length, std::string &scratch);
+
+		size_t skip(size_t size)
+		{
+			if (static_cast<size_t>(end - cursor) < size)
+				return skipSlow(size);
+
+			cursor += size;
+			return size;
+		}
+
+	protected:
+		// Makes more bytes available in [cursor, end). Returns false at the end
+		// of the stream.
+		virtual bool refill() = 0;
+		// Skips bytes past the end of the current window. The default
+		// implementation refills and throws the data away.
+		virtual size_t discard(size_t size);
+
+		const Byte *cursor, *end;
+
+	private:
+		Stream3DS(const Stream3DS &);
+		Stream3DS &operator =(const Stream3DS &);
+
+		size_t readSlow(void *buffer, size_t size);
+		size_t skipSlow(size_t size);
+};
+
+// Reads straight out of a buffer owned by the caller, without copying it.
+class MemoryStream3DS: public Stream3DS
+{
+	public:
+		MemoryStream3DS(const void *data, size_t size);
+
+	protected:
+		bool refill() { return false; }
+		size_t discard(size_t) { return 0; }
+};
+
+// Reads from a stdio stream through an internal buffer. The FILE is not
+// closed by the stream. While it reads, the FILE is ahead of the bytes
+// consumed by up to a buffer; on destruction it is seeked back to just
+// after them, which pipes and other unseekable streams can't do.
+class FileStream3DS: public Stream3DS
+{
+	public:
+		FileStream3DS(FILE *fp, size_t bufferSize = 64*1024);
+		~FileStream3DS();
+
+	protected:
+		bool refill();
+		size_t discard(size_t size);
+
+	private:
+		FILE *fp;
+		Byte *buffer;
+		size_t bufferSize;
+};
+
+// Reads through user supplied callbacks, e.g. from an archive or a network
+// cache. The read callback returns the number of bytes stored in buffer, 0 at
+// the end of data. The skip callback is optional; without it skipped data is
+// read and thrown away.
+class CallbackStream3DS: public Stream3DS
+{
+	public:
+		typedef size_t (*ReadCallback)(void *userData, void *buffer, size_t size);
+		typedef size_t (*SkipCallback)(void *userData, size_t size);
+
+		CallbackStream3DS(ReadCallback readCallback, SkipCallback skipCallback, void *userData, size_t bufferSize = 64*1024);
+		~CallbackStream3DS();
+
+	protected:
+		bool refill();
+		size_t discard(size_t size);
+
+	private:
+		ReadCallback readCallback;
+		SkipCallback skipCallback;
+		void *userData;
+		Byte *buffer;
+		size_t bufferSize;
+};
+
+#endif // _STREAM3DS_H_
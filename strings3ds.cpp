@@ -0,0 +1,96 @@
+#include "strings3ds.h"
+
+#include <cstring>
+
+namespace
+{
+	const size_t initialSlots = 64;
+}
+
+StringTable::StringTable(Arena3DS &arena):
+	slots(initialSlots, noStringId),
+	arena(arena)
+{}
+
+StringId StringTable::intern(const char *text, size_t length)
+{
+	DWord textHash = hash(text, length);
+	size_t slot = findSlot(text, length, textHash);
+
+	if (slots[slot] != noStringId)
+		return slots[slot];
+
+	StringId id = strings.size();
+	strings.push_back(store(text, length));
+	lengths.push_back(length);
+	hashes.push_back(textHash);
+	slots[slot] = id;
+
+	// keep the load factor under 1/2
+	if (strings.size()*2 > slots.size())
+		grow();
+
+	return id;
+}
+
+StringId StringTable::intern(const char *text)
+{
+	return intern(text, strlen(text));
+}
+
+StringId StringTable::find(const char *text, size_t length) const
+{
+	return slots[findSlot(text, length, hash(text, length))];
+}
+
+// FNV-1a
+DWord StringTable::hash(const char *text, size_t length)
+{
+	DWord h = 2166136261u;
+
+	for (size_t i=0; i<length; ++i) {
+		h ^= static_cast<Byte>(text[i]);
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+size_t StringTable::findSlot(const char *text, size_t length, DWord textHash) const
+{
+	size_t mask = slots.size() - 1;
+	size_t slot = textHash & mask;
+
+	while (slots[slot] != noStringId) {
+		StringId id = slots[slot];
+		if (hashes[id] == textHash && lengths[id] == length && memcmp(strings[id], text, length) == 0)
+			break;
+
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+void StringTable::grow()
+{
+	slots.assign(slots.size()*2, noStringId);
+	size_t mask = slots.size() - 1;
+
+	for (StringId id=0; id<strings.size(); ++id) {
+		size_t slot = hashes[id] & mask;
+		while (slots[slot] != noStringId)
+			slot = (slot + 1) & mask;
+
+		slots[slot] = id;
+	}
+}
+
+const char *StringTable::store(const char *text, size_t length)
+{
+	char *p = static_cast<char *>(arena.allocate(length + 1, 1));
+	memcpy(p, text, length);
+	p[length] = '\0';
+	
+	return p;
+}
@@ -0,0 +1,46 @@
+#ifndef _STRINGS3DS_H_
+#define _STRINGS3DS_H_
+
+#include <cstdlib>
+#include <vector>
+#include <GL/gl.h>
+
+#include "types3ds.h"
+#include "arena3ds.h"
+
+using namespace std;
+
+// Interned strings of a model. Every distinct string is stored once and
+// identified by a small dense id, so names can be compared by id. The
+// characters are kept in an arena and the pointers returned by get() stay
+// valid as long as it is.
+class StringTable
+{
+	public:
+		StringTable(Arena3DS &arena);
+
+		StringId intern(const char *text, size_t length);
+		StringId intern(const char *text);
+		// noStringId if text was never interned
+		StringId find(const char *text, size_t length) const;
+
+		const char *get(StringId id) const { return strings[id]; }
+		size_t size() const { return strings.size(); }
+
+	private:
+		StringTable(const StringTable &);
+		StringTable &operator =(const StringTable &);
+
+		static DWord hash(const char *text, size_t length);
+		size_t findSlot(const char *text, size_t length, DWord textHash) const;
+		void grow();
+		const char *store(const char *text, size_t length);
+
+		vector<const char *> strings; // by id
+		vector<DWord> lengths, hashes; // by id
+		vector<StringId> slots; // open addressing, noStringId marks an empty slot
+
+		Arena3DS &arena;
+};
+
+#endif // _STRINGS3DS_H_
@@ -0,0 +1,324 @@
+#include "texture3ds.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+	// gluBuild2DMipmaps scales to the closest power of two as well
+	GLsizei closestPowerOfTwo(GLsizei n)
+	{
+		GLsizei p = 1;
+		while (p*2 <= n)
+			p *= 2;
+
+		return (n - p > 2*p - n) ? p*2 : p;
+	}
+
+	void resample(const Byte *src, GLsizei width, GLsizei height, MipChain::Level &level)
+	{
+		level.pixels.resize(level.width*level.height*4);
+
+		GLfloat scaleX = static_cast<GLfloat>(width) / level.width;
+		GLfloat scaleY = static_cast<GLfloat>(height) / level.height;
+
+		for (GLsizei y=0; y<level.height; ++y) {
+			GLfloat sy = max(0.f, (y + 0.5f)*scaleY - 0.5f);
+			GLsizei y0 = min(static_cast<GLsizei>(sy), height-1);
+			GLsizei y1 = min(y0+1, height-1);
+			GLfloat fy = sy - y0;
+
+			for (GLsizei x=0; x<level.width; ++x) {
+				GLfloat sx = max(0.f, (x + 0.5f)*scaleX - 0.5f);
+				GLsizei x0 = min(static_cast<GLsizei>(sx), width-1);
+				GLsizei x1 = min(x0+1, width-1);
+				GLfloat fx = sx - x0;
+
+				for (int c=0; c<4; ++c) {
+					GLfloat top = src[(y0*width + x0)*4 + c]*(1.f-fx) + src[(y0*width + x1)*4 + c]*fx;
+					GLfloat bottom = src[(y1*width + x0)*4 + c]*(1.f-fx) + src[(y1*width + x1)*4 + c]*fx;
+					level.pixels[(y*level.width + x)*4 + c] = static_cast<Byte>(top*(1.f-fy) + bottom*fy + 0.5f);
+				}
+			}
+		}
+	}
+
+	// 2x2 box filter, a dimension that is already 1 stays 1
+	void halve(const MipChain::Level &src, MipChain::Level &level)
+	{
+		level.width = max(src.width/2, 1);
+		level.height = max(src.height/2, 1);
+		level.pixels.resize(level.width*level.height*4);
+
+		for (GLsizei y=0; y<level.height; ++y) {
+			const Byte *row0 = &src.pixels[min(y*2, src.height-1)*src.width*4];
+			const Byte *row1 = &src.pixels[min(y*2+1, src.height-1)*src.width*4];
+
+			for (GLsizei x=0; x<level.width; ++x) {
+				GLsizei x0 = min(x*2, src.width-1)*4;
+				GLsizei x1 = min(x*2+1, src.width-1)*4;
+
+				for (int c=0; c<4; ++c) {
+					int sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+					level.pixels[(y*level.width + x)*4 + c] = static_cast<Byte>((sum + 2) / 4);
+				}
+			}
+		}
+	}
+}
+
+void TextureJob::decode()
+{
+	sf::Lock lock(mutex);
+
+	if (decoded)
+		return;
+
+	run();
+	decoded = true;
+}
+
+bool TextureJob::upload(GLuint texture)
+{
+	const MipChain &chain = getMipChain();
+	sf::Lock lock(mutex);
+
+	if (!chain.valid)
+		return false;
+
+	// levels too big for the implementation are dropped
+	GLint maxSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+
+	size_t first = 0;
+	while (first+1 < chain.levels.size() && (chain.levels[first].width > maxSize || chain.levels[first].height > maxSize))
+		++first;
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	// select modulate to mix texture with color for shading
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+	// when texture area is small, bilinear filter the closest mipmap
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	// when texture area is large, bilinear filter the original
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	// the texture wraps over at the edges (repeat)
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	for (size_t i=first; i<chain.levels.size(); ++i) {
+		const MipChain::Level &level = chain.levels[i];
+		glTexImage2D(GL_TEXTURE_2D, i-first, GL_RGBA, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &level.pixels[0]);
+	}
+
+	mipChain.levels.clear();
+
+	return true;
+}
+
+void TextureJob::run()
+{
+#ifdef OPEN3DS_PROFILE
+	sf::Clock clock;
+#endif
+
+	sf::Image image;
+
+	if (!image.LoadFromFile(fileName) || image.GetWidth() == 0 || image.GetHeight() == 0)
+		return;
+
+#ifdef OPEN3DS_PROFILE
+	decodeSeconds = clock.GetElapsedTime();
+	clock.Reset();
+#endif
+
+	GLsizei width = image.GetWidth();
+	GLsizei height = image.GetHeight();
+
+	mipChain.levels.resize(1);
+	MipChain::Level &base = mipChain.levels[0];
+	base.width = closestPowerOfTwo(width);
+	base.height = closestPowerOfTwo(height);
+
+	if (base.width == width && base.height == height)
+		base.pixels.assign(image.GetPixelsPtr(), image.GetPixelsPtr() + width*height*4);
+	else
+		resample(image.GetPixelsPtr(), width, height, base);
+
+	while (mipChain.levels.back().width > 1 || mipChain.levels.back().height > 1) {
+		mipChain.levels.push_back(MipChain::Level());
+		halve(mipChain.levels[mipChain.levels.size()-2], mipChain.levels.back());
+	}
+
+#ifdef OPEN3DS_PROFILE
+	mipSeconds = clock.GetElapsedTime();
+#endif
+
+	mipChain.valid = true;
+}
+
+TextureRegistry::TextureRegistry()
+{
+	for (unsigned int i=0; i<numWorkers; ++i) {
+		workers[i].registry = this;
+		workers[i].thread = new sf::Thread(&TextureRegistry::work, &workers[i]);
+	}
+}
+
+TextureRegistry::~TextureRegistry()
+{
+	{
+		sf::Lock lock(mutex);
+
+		for (size_t i=0; i<pending.size(); ++i)
+			if (releaseJob(pending[i]))
+				delete pending[i];
+
+		pending.clear();
+	}
+
+	for (unsigned int i=0; i<numWorkers; ++i) {
+		workers[i].thread->Wait();
+		delete workers[i].thread;
+	}
+}
+
+TextureRegistry &TextureRegistry::instance()
+{
+	static TextureRegistry registry;
+	return registry;
+}
+
+void TextureRegistry::work(void *userData)
+{
+	Worker &worker = *static_cast<Worker *>(userData);
+	TextureRegistry &registry = *worker.registry;
+
+	for (;;) {
+		TextureJob *job;
+
+		{
+			sf::Lock lock(registry.mutex);
+
+			if (registry.pending.empty()) {
+				worker.busy = false;
+				return;
+			}
+
+			job = registry.pending.front();
+			registry.pending.pop_front();
+
+			// released by all its models while waiting
+			if (job->references == 1) {
+				delete job;
+				continue;
+			}
+		}
+
+		job->decode();
+
+		bool last;
+
+		{
+			sf::Lock lock(registry.mutex);
+			last = registry.releaseJob(job);
+		}
+
+		if (last)
+			delete job;
+	}
+}
+
+void TextureRegistry::queue(TextureJob *job)
+{
+	if (job->queued)
+		return;
+
+	job->queued = true;
+	++job->references;
+	pending.push_back(job);
+
+	for (unsigned int i=0; i<numWorkers; ++i) {
+		if (!workers[i].busy) {
+			workers[i].busy = true;
+			// it is past its last lock if it ran before
+			workers[i].thread->Wait();
+			workers[i].thread->Launch();
+			break;
+		}
+	}
+}
+
+bool TextureRegistry::releaseJob(TextureJob *job)
+{
+	return --job->references == 0;
+}
+
+SharedTexture *TextureRegistry::acquire(const string &fileName, bool decode)
+{
+	SharedTexture *texture;
+
+	{
+		sf::Lock lock(mutex);
+
+		map<string, SharedTexture *>::iterator it = textures.find(fileName);
+
+		if (it != textures.end()) {
+			texture = it->second;
+			++texture->references;
+		} else {
+			texture = new SharedTexture(fileName);
+			textures[fileName] = texture;
+		}
+
+		if (decode)
+			queue(texture->job);
+	}
+
+	return texture;
+}
+
+void TextureRegistry::release(SharedTexture *texture)
+{
+	bool lastJobReference;
+
+	{
+		sf::Lock lock(mutex);
+
+		if (--texture->references > 0)
+			return;
+
+		textures.erase(texture->job->getFileName());
+		lastJobReference = releaseJob(texture->job);
+	}
+
+	if (texture->name != 0)
+		glDeleteTextures(1, &texture->name);
+
+	// a worker still decoding it deletes it when done
+	if (lastJobReference)
+		delete texture->job;
+
+	delete texture;
+}
+
+GLuint TextureRegistry::upload(SharedTexture *texture)
+{
+	if (texture->uploaded)
+		return texture->name;
+
+	GLuint name;
+	glGenTextures(1, &name);
+
+	if (!texture->job->upload(name)) {
+		glDeleteTextures(1, &name);
+		name = 0;
+	}
+
+	texture->name = name;
+	texture->uploaded = true;
+
+	return name;
+}
@@ -0,0 +1,127 @@
+#ifndef _TEXTURE3DS_H_
+#define _TEXTURE3DS_H_
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <map>
+#include <SFML/Graphics.hpp>
+#include <GL/gl.h>
+
+#include "types3ds.h"
+
+using namespace std;
+
+// RGBA image with its whole mip chain, built on the CPU so that uploading it
+// is just a glTexImage2D call per level.
+struct MipChain
+{
+	struct Level
+	{
+		GLsizei width, height;
+		vector<Byte> pixels;
+	};
+
+	MipChain(): valid(false) {}
+
+	vector<Level> levels;
+	bool valid;
+};
+
+// Decodes a texture file and builds its mip chain, on the workers of the
+// TextureRegistry or on whichever thread needs it first.
+class TextureJob
+{
+	public:
+		TextureJob(const string &fileName): fileName(fileName), decoded(false), queued(false), references(1), decodeSeconds(0.f), mipSeconds(0.f) {}
+
+		// Decodes the file on the calling thread unless it is done already, or
+		// waits for the thread decoding it.
+		void decode();
+		const MipChain &getMipChain() { decode(); return mipChain; }
+		// Creates the GL texture and frees the CPU copy. Needs a current GL
+		// context, returns false if the file couldn't be decoded.
+		bool upload(GLuint texture);
+
+		const string &getFileName() const { return fileName; }
+		// measured only when built with OPEN3DS_PROFILE
+		float getDecodeSeconds() const { return decodeSeconds; }
+		float getMipSeconds() const { return mipSeconds; }
+
+	private:
+		friend class TextureRegistry;
+
+		void run();
+
+		string fileName;
+		MipChain mipChain;
+		bool decoded, queued;
+		// of its SharedTexture and of the decoding queue, guarded by the
+		// registry
+		unsigned int references;
+		sf::Mutex mutex; // held while decoding
+		float decodeSeconds, mipSeconds;
+};
+
+// Texture shared by all the models using the same file.
+struct SharedTexture
+{
+	SharedTexture(const string &fileName): job(new TextureJob(fileName)), name(0), references(1), uploaded(false) {}
+
+	TextureJob *job; // deleted by the registry with its last reference
+	GLuint name; // 0 until uploaded or if the file couldn't be decoded
+	unsigned int references;
+	bool uploaded;
+};
+
+// Process-wide registry of the textures of all models keyed by the resolved
+// file name, so each file is decoded and uploaded once however many models
+// use it. Textures are reference counted and deleted with the last model.
+// acquire() may be called from any thread, upload() and a release() that may
+// delete an uploaded texture only from the thread owning the GL context.
+//
+// The files are decoded in the order they are acquired by a pool of
+// numWorkers threads shared by all models, which end when the queue is
+// empty and are launched again by the next acquire().
+class TextureRegistry
+{
+	public:
+		static const unsigned int numWorkers = 4;
+
+		static TextureRegistry &instance();
+
+		// Adds a reference to the texture of fileName and queues its decoding
+		// if decode is set. Never waits for a decoding.
+		SharedTexture *acquire(const string &fileName, bool decode);
+		void release(SharedTexture *texture);
+		// Returns the GL texture, creating it on the first call. 0 means the
+		// file couldn't be decoded.
+		GLuint upload(SharedTexture *texture);
+
+	private:
+		struct Worker
+		{
+			Worker(): registry(NULL), thread(NULL), busy(false) {}
+
+			TextureRegistry *registry;
+			sf::Thread *thread;
+			bool busy; // launched and not out of jobs yet
+		};
+
+		TextureRegistry();
+		~TextureRegistry();
+		TextureRegistry(const TextureRegistry &);
+		TextureRegistry &operator =(const TextureRegistry &);
+
+		static void work(void *userData);
+		// with mutex locked
+		void queue(TextureJob *job);
+		bool releaseJob(TextureJob *job);
+
+		map<string, SharedTexture *> textures;
+		deque<TextureJob *> pending; // not taken by a worker yet
+		Worker workers[numWorkers];
+		sf::Mutex mutex;
+};
+
+#endif // _TEXTURE3DS_H_
@@ -0,0 +1,394 @@
+// Headless validator and converter for many .3ds files at once.
+//
+// 3ds-tool [options] file...
+//   -j N        parse N files at a time, all the processors by default
+//   --bake      write each valid model to <file>.bake, see Model3DS::bake()
+//   --optimize  optimize the meshes before baking them
+//   --quiet     only report the files with problems
+//
+// Every file is checked chunk by chunk and its parsed model for indices out
+// of range, and a line of statistics is printed per file in the order of
+// the arguments. The exit status is 1 if any file has a problem.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "../3ds.h"
+#include "../mapping3ds.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+	struct Options
+	{
+		Options(): numThreads(0), bake(false), optimize(false), quiet(false) {}
+
+		unsigned int numThreads;
+		bool bake, optimize, quiet;
+	};
+
+	struct Result
+	{
+		Result(): parsed(false), numObjects(0), numVertices(0), numFaces(0), numMaterials(0), seconds(0.f) {}
+
+		bool parsed;
+		unsigned long numObjects, numVertices, numFaces, numMaterials;
+		float seconds; // parse
+		vector<string> problems;
+	};
+
+	struct Batch
+	{
+		const Options *options;
+		vector<const char *> fileNames;
+		vector<Result> results; // by file
+	};
+
+	unsigned int countProcessors()
+	{
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwNumberOfProcessors;
+#else
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		return n > 0 ? n : 1;
+#endif
+	}
+
+	void addProblem(Result &result, const string &problem)
+	{
+		result.problems.push_back(problem);
+	}
+
+	string hexId(Word id)
+	{
+		char text[8];
+		sprintf(text, "%04X", id);
+		return text;
+	}
+
+	// a container chunk being checked
+	struct Span
+	{
+		Span(size_t position, size_t end): position(position), end(end) {}
+
+		size_t position, end; // of the next chunk and of the container
+	};
+
+	// Checks that the chunks in [begin, end) fit in each other and that the
+	// arrays of the mesh chunks fit in their chunk. The parser reads past
+	// such damage, so it has to be found on the raw data. The containers
+	// are walked with a stack of their own, as a file can nest them as deep
+	// as its size allows.
+	void checkChunks(const Byte *data, size_t begin, size_t end, Result &result)
+	{
+		vector<Span> spans(1, Span(begin, end));
+
+		while (!spans.empty()) {
+			size_t position = spans.back().position;
+			size_t spanEnd = spans.back().end;
+
+			if (position >= spanEnd) {
+				spans.pop_back();
+				continue;
+			}
+
+			// a damaged chunk ends the check of its container
+			if (spanEnd - position < static_cast<size_t>(cfg3ds::chunkHeaderSize)) {
+				ostringstream problem;
+				problem << "truncated chunk header at " << position;
+				addProblem(result, problem.str());
+				spans.pop_back();
+				continue;
+			}
+
+			Word id;
+			DWord length;
+			memcpy(&id, data + position, sizeof(id));
+			memcpy(&length, data + position + sizeof(id), sizeof(length));
+
+			ostringstream where;
+			where << "chunk " << hexId(id) << " at " << position;
+
+			if (length < static_cast<DWord>(cfg3ds::chunkHeaderSize)) {
+				addProblem(result, where.str() + " is shorter than its header");
+				spans.pop_back();
+				continue;
+			}
+			if (length > spanEnd - position) {
+				ostringstream problem;
+				problem << where.str() << " exceeds its parent by " << length - (spanEnd - position) << " bytes";
+				addProblem(result, problem.str());
+				spans.pop_back();
+				continue;
+			}
+
+			size_t content = position + cfg3ds::chunkHeaderSize;
+			size_t chunkEnd = position + length;
+			Word count = 0;
+			if (chunkEnd - content >= sizeof(count))
+				memcpy(&count, data + content, sizeof(count));
+
+			// the container goes on after this chunk once its own chunks
+			// pushed below are checked
+			spans.back().position = chunkEnd;
+
+			switch (id)
+			{
+				case chunks::MAIN:
+				case chunks::EDIT:
+				case chunks::OBJECT_MESH:
+				case chunks::EDIT_MATERIAL:
+				case chunks::MATERIAL_TEXMAP:
+				case chunks::KEYFRAMER:
+				case chunks::KEYFRAMER_MESHINFO:
+					spans.push_back(Span(content, chunkEnd));
+					break;
+
+				case chunks::EDIT_OBJECT: {
+					const void *name = memchr(data + content, '\0', chunkEnd - content);
+					if (name == NULL)
+						addProblem(result, where.str() + " has no name");
+					else
+						spans.push_back(Span(static_cast<const Byte *>(name) - data + 1, chunkEnd));
+					break;
+				}
+
+				case chunks::MESH_VERTICES:
+					if (sizeof(count) + count*sizeof(Vertex) > chunkEnd - content)
+						addProblem(result, where.str() + " is too short for its vertices");
+					break;
+
+				case chunks::MESH_MAPCOORDS:
+					if (sizeof(count) + count*sizeof(MapCoord) > chunkEnd - content)
+						addProblem(result, where.str() + " is too short for its map coords");
+					break;
+
+				case chunks::MESH_FACES: {
+					// four Words per face, then the material and smoothing chunks
+					size_t faces = sizeof(count) + count*4*sizeof(Word);
+					if (faces > chunkEnd - content)
+						addProblem(result, where.str() + " is too short for its faces");
+					else
+						spans.push_back(Span(content + faces, chunkEnd));
+					break;
+				}
+			}
+		}
+	}
+
+	void checkModel(const Model3DS &model, Result &result)
+	{
+		const vector<Object> &objects = model.getObjects();
+		const vector<VertexList> &vertexLists = model.getVertexLists();
+
+		for (size_t i=0; i<objects.size(); ++i) {
+			const Object &object = objects[i];
+			string name = (object.name != NULL ? object.name : "");
+
+			for (Word j=0; j<object.numFaces; ++j) {
+				const Face &face = object.faces[j];
+				if (face.vertexA >= object.numVertices || face.vertexB >= object.numVertices || face.vertexC >= object.numVertices) {
+					addProblem(result, "object " + name + ": a face refers to a vertex that doesn't exist");
+					break;
+				}
+			}
+
+			if (object.mapCoords != NULL && object.numMapCoords != object.numVertices)
+				addProblem(result, "object " + name + ": map coords and vertices differ in number");
+
+			for (DWord j=0; j<object.numVertexLists; ++j) {
+				const VertexList &vertexList = vertexLists[object.firstVertexList + j];
+				for (DWord k=0; k<vertexList.numVerticesRefs; ++k) {
+					if (vertexList.verticesRefs[k] >= object.numVertices) {
+						addProblem(result, "object " + name + ": a material refers to a vertex that doesn't exist");
+						break;
+					}
+				}
+			}
+
+			result.numVertices += object.numVertices;
+			result.numFaces += object.numFaces;
+		}
+
+		const vector<string> &textureFiles = model.getTextureFiles();
+		for (size_t i=0; i<textureFiles.size(); ++i) {
+			FILE *fp = fopen(textureFiles[i].c_str(), "rb");
+			if (fp == NULL)
+				addProblem(result, "missing texture " + textureFiles[i]);
+			else
+				fclose(fp);
+		}
+
+		result.numObjects = objects.size();
+		result.numMaterials = model.getMaterials().size();
+	}
+
+	void processFile(const Options &options, const char *fileName, Result &result)
+	{
+		{
+			MappedFile file;
+			if (!file.open(fileName)) {
+				addProblem(result, "can't read the file");
+				return;
+			}
+
+			const Byte *data = static_cast<const Byte *>(file.data());
+			Word id = 0;
+			DWord length = 0;
+			if (file.size() >= static_cast<size_t>(cfg3ds::chunkHeaderSize)) {
+				memcpy(&id, data, sizeof(id));
+				memcpy(&length, data + sizeof(id), sizeof(length));
+			}
+
+			if (id != chunks::MAIN) {
+				addProblem(result, "not a 3DS file");
+				return;
+			}
+
+			if (length != file.size()) {
+				ostringstream problem;
+				problem << "main chunk of " << length << " bytes in a file of " << file.size();
+				addProblem(result, problem.str());
+			}
+
+			size_t end = min(static_cast<size_t>(length), file.size());
+			checkChunks(data, cfg3ds::chunkHeaderSize, end, result);
+		}
+
+		Model3DS model;
+		model.setTextureDecoding(false);
+		// the files are already spread over the threads
+		model.setNormalThreads(1);
+
+		try {
+			sf::Clock clock;
+			result.parsed = model.parse(fileName);
+			result.seconds = clock.GetElapsedTime();
+		} catch (exception &e) {
+			addProblem(result, e.what());
+			return;
+		}
+
+		if (!result.parsed) {
+			addProblem(result, "can't parse the file");
+			return;
+		}
+
+		checkModel(model, result);
+
+		if (options.optimize)
+			model.optimize();
+
+		if (options.bake && result.problems.empty()) {
+			string bakedFileName = string(fileName) + ".bake";
+			if (!model.bake(bakedFileName.c_str()))
+				addProblem(result, "can't write " + bakedFileName);
+		}
+	}
+
+	void processFiles(void *context, size_t begin, size_t end)
+	{
+		Batch *batch = static_cast<Batch *>(context);
+
+		for (size_t i=begin; i<end; ++i) {
+			try {
+				processFile(*batch->options, batch->fileNames[i], batch->results[i]);
+			} catch (exception &e) {
+				// e.g. out of memory, forEachRange() must not see it
+				addProblem(batch->results[i], e.what());
+			}
+		}
+	}
+
+	void printUsage()
+	{
+		fprintf(stderr, "usage: 3ds-tool [-j threads] [--bake] [--optimize] [--quiet] file...\n");
+	}
+
+	// Keeps the parser's warnings of different threads from interleaving.
+	sf::Mutex logMutex;
+
+	void logSink(log3ds::Level level, const char *message, void *)
+	{
+		static const char *prefixes[] = {"debug", "info", "warning", "error"};
+
+		sf::Lock lock(logMutex);
+		fprintf(stderr, "3ds %s: %s\n", prefixes[level], message);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	Batch batch;
+	batch.options = &options;
+
+	for (int i=1; i<argc; ++i) {
+		if (strcmp(argv[i], "-j") == 0 && i+1 < argc)
+			options.numThreads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--bake") == 0)
+			options.bake = true;
+		else if (strcmp(argv[i], "--optimize") == 0)
+			options.optimize = true;
+		else if (strcmp(argv[i], "--quiet") == 0)
+			options.quiet = true;
+		else if (argv[i][0] == '-') {
+			printUsage();
+			return EXIT_FAILURE;
+		} else
+			batch.fileNames.push_back(argv[i]);
+	}
+
+	if (batch.fileNames.empty()) {
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
+	if (options.numThreads == 0)
+		options.numThreads = countProcessors();
+
+	log3ds::setSink(logSink);
+	batch.results.resize(batch.fileNames.size());
+
+	sf::Clock clock;
+	parallel3ds::forEachRange(batch.fileNames.size(), 1, processFiles, &batch, options.numThreads);
+	float seconds = clock.GetElapsedTime();
+
+	unsigned long numFailed = 0, numFaces = 0;
+	float parseSeconds = 0.f;
+
+	for (size_t i=0; i<batch.results.size(); ++i) {
+		const Result &result = batch.results[i];
+		bool failed = !result.problems.empty();
+
+		numFailed += failed;
+		numFaces += result.numFaces;
+		parseSeconds += result.seconds;
+
+		if (options.quiet && !failed)
+			continue;
+
+		printf("%-6s %s: %lu objects, %lu vertices, %lu faces, %lu materials, %.3f ms\n",
+			failed ? "FAIL" : "ok", batch.fileNames[i],
+			result.numObjects, result.numVertices, result.numFaces, result.numMaterials,
+			result.seconds * 1000.0);
+
+		for (size_t j=0; j<result.problems.size(); ++j)
+			printf("       %s\n", result.problems[j].c_str());
+	}
+
+	printf("%lu files, %lu failed, %lu faces, %.3f s parsing, %.3f s on %u threads\n",
+		static_cast<unsigned long>(batch.fileNames.size()), numFailed, numFaces,
+		parseSeconds, seconds, options.numThreads);
+
+	return numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
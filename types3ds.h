@@ -2,17 +2,17 @@
 #define _TYPES3DS_H_
 
 #include <cmath>
-
-template <typename T>
-void deleteElement(T *p)
-{
-	delete p;
-}
+#include <cfloat>
 
 typedef unsigned char Byte;
 typedef unsigned short Word;
 typedef unsigned int DWord;
 
+typedef DWord StringId; // see StringTable
+const StringId noStringId = 0xFFFFFFFF; // a name that was never interned
+
+const DWord noIndex = 0xFFFFFFFF; // an index into none of the model's arrays
+
 enum Axis { x, y, z };
 
 struct ChunkHeader
@@ -117,9 +117,262 @@ struct Vector
 
 typedef Vector Vertex;
 
+struct Quaternion
+{
+	Quaternion(GLfloat x = 0.f, GLfloat y = 0.f, GLfloat z = 0.f, GLfloat w = 1.f): x(x), y(y), z(z), w(w) {}
+	
+	// a rotation by angle radians around axis, which needn't be unit length
+	static Quaternion fromAxisAngle(const Vector &axis, GLfloat angle)
+	{
+		GLfloat length = axis.length();
+		if (length == 0.f)
+			return Quaternion();
+		
+		GLfloat s = sin(angle*0.5f) / length;
+		return Quaternion(axis.x*s, axis.y*s, axis.z*s, cos(angle*0.5f));
+	}
+	// the rotation by q followed by this one
+	Quaternion operator *(const Quaternion &q) const
+	{
+		return Quaternion(
+			w*q.x + x*q.w + y*q.z - z*q.y,
+			w*q.y + y*q.w + z*q.x - x*q.z,
+			w*q.z + z*q.w + x*q.y - y*q.x,
+			w*q.w - x*q.x - y*q.y - z*q.z);
+	}
+	
+	GLfloat x, y, z, w;
+};
+
+// 4x4, column-major like glMultMatrixf() takes it
+struct Matrix
+{
+	Matrix()
+	{
+		for (int i=0; i<16; ++i)
+			m[i] = (i % 5 == 0 ? 1.f : 0.f);
+	}
+	
+	static Matrix translation(const Vector &v)
+	{
+		Matrix r;
+		r.m[12] = v.x;
+		r.m[13] = v.y;
+		r.m[14] = v.z;
+		return r;
+	}
+	static Matrix scaling(const Vector &v)
+	{
+		Matrix r;
+		r.m[0] = v.x;
+		r.m[5] = v.y;
+		r.m[10] = v.z;
+		return r;
+	}
+	// like glRotatef() around one of the axes
+	static Matrix rotation(GLfloat degrees, Axis axis)
+	{
+		GLfloat radians = degrees * 3.14159265358979f / 180.f;
+		GLfloat c = cos(radians), s = sin(radians);
+		// the two other axes, in the order that makes the rotation counterclockwise
+		int i = (axis + 1) % 3, j = (axis + 2) % 3;
+		
+		Matrix r;
+		r.m[i*4 + i] = c;
+		r.m[i*4 + j] = s;
+		r.m[j*4 + i] = -s;
+		r.m[j*4 + j] = c;
+		return r;
+	}
+	// the matrix with u, v and w as its first three columns
+	static Matrix basis(const Vector &u, const Vector &v, const Vector &w)
+	{
+		Matrix r;
+		r.m[0] = u.x; r.m[1] = u.y; r.m[2] = u.z;
+		r.m[4] = v.x; r.m[5] = v.y; r.m[6] = v.z;
+		r.m[8] = w.x; r.m[9] = w.y; r.m[10] = w.z;
+		return r;
+	}
+	
+	// the transformation by a followed by this one
+	Matrix operator *(const Matrix &a) const
+	{
+		Matrix r;
+		for (int column=0; column<4; ++column) {
+			for (int row=0; row<4; ++row) {
+				r.m[column*4 + row] = m[row]*a.m[column*4] + m[4 + row]*a.m[column*4 + 1] +
+					m[8 + row]*a.m[column*4 + 2] + m[12 + row]*a.m[column*4 + 3];
+			}
+		}
+		return r;
+	}
+	
+	Vector transformPoint(const Vector &p) const
+	{
+		return Vector(m[0]*p.x + m[4]*p.y + m[8]*p.z + m[12],
+			m[1]*p.x + m[5]*p.y + m[9]*p.z + m[13],
+			m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14]);
+	}
+	// without the translation
+	Vector transformVector(const Vector &v) const
+	{
+		return Vector(m[0]*v.x + m[4]*v.y + m[8]*v.z,
+			m[1]*v.x + m[5]*v.y + m[9]*v.z,
+			m[2]*v.x + m[6]*v.y + m[10]*v.z);
+	}
+	
+	// Of a matrix without projection, i.e. a last row of 0, 0, 0, 1. Returns
+	// false if it is singular, e.g. scaled by 0.
+	bool getInverse(Matrix &inverse) const
+	{
+		// the adjugate of the upper 3x3
+		GLfloat a[9] = {
+			m[5]*m[10] - m[6]*m[9], m[2]*m[9] - m[1]*m[10], m[1]*m[6] - m[2]*m[5],
+			m[6]*m[8] - m[4]*m[10], m[0]*m[10] - m[2]*m[8], m[2]*m[4] - m[0]*m[6],
+			m[4]*m[9] - m[5]*m[8], m[1]*m[8] - m[0]*m[9], m[0]*m[5] - m[1]*m[4]
+		};
+		GLfloat determinant = m[0]*a[0] + m[4]*a[1] + m[8]*a[2];
+		if (determinant == 0.f)
+			return false;
+		
+		inverse = Matrix();
+		for (int column=0; column<3; ++column) {
+			for (int row=0; row<3; ++row)
+				inverse.m[column*4 + row] = a[column*3 + row] / determinant;
+		}
+		
+		Vector t = inverse.transformVector(Vector(m[12], m[13], m[14]));
+		inverse.m[12] = -t.x;
+		inverse.m[13] = -t.y;
+		inverse.m[14] = -t.z;
+		return true;
+	}
+	
+	GLfloat m[16];
+};
+
+// Axis aligned, empty until something is added.
+struct BoundingBox
+{
+	BoundingBox(): lower(FLT_MAX, FLT_MAX, FLT_MAX), upper(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+	
+	bool isEmpty() const { return lower.x > upper.x; }
+	
+	void add(const Vector &p)
+	{
+		if (p.x < lower.x) lower.x = p.x;
+		if (p.y < lower.y) lower.y = p.y;
+		if (p.z < lower.z) lower.z = p.z;
+		if (p.x > upper.x) upper.x = p.x;
+		if (p.y > upper.y) upper.y = p.y;
+		if (p.z > upper.z) upper.z = p.z;
+	}
+	void add(const BoundingBox &box)
+	{
+		if (!box.isEmpty()) {
+			add(box.lower);
+			add(box.upper);
+		}
+	}
+	
+	// the box around this one transformed by matrix (Arvo's method)
+	BoundingBox transformed(const Matrix &matrix) const
+	{
+		if (isEmpty())
+			return *this;
+		
+		const GLfloat *m = matrix.m;
+		const GLfloat from[2][3] = {{lower.x, lower.y, lower.z}, {upper.x, upper.y, upper.z}};
+		GLfloat to[2][3] = {{m[12], m[13], m[14]}, {m[12], m[13], m[14]}};
+		
+		for (int row=0; row<3; ++row) {
+			for (int column=0; column<3; ++column) {
+				GLfloat a = m[column*4 + row]*from[0][column];
+				GLfloat b = m[column*4 + row]*from[1][column];
+				to[0][row] += (a < b ? a : b);
+				to[1][row] += (a < b ? b : a);
+			}
+		}
+		
+		BoundingBox r;
+		r.lower = Vector(to[0][0], to[0][1], to[0][2]);
+		r.upper = Vector(to[1][0], to[1][1], to[1][2]);
+		return r;
+	}
+	
+	Vector lower, upper;
+};
+
+// The planes of a view frustum, with their normals pointing inside.
+struct Frustum
+{
+	enum Overlap { outside, partly, inside };
+	
+	// from the projection times the modelview matrix, in the space of the
+	// modelview (Gribb and Hartmann)
+	Frustum(const Matrix &clip)
+	{
+		const GLfloat *m = clip.m;
+		for (int i=0; i<3; ++i) {
+			for (int j=0; j<4; ++j) {
+				planes[2*i][j] = m[j*4 + 3] + m[j*4 + i];
+				planes[2*i + 1][j] = m[j*4 + 3] - m[j*4 + i];
+			}
+		}
+	}
+	
+	Overlap overlap(const BoundingBox &box) const
+	{
+		if (box.isEmpty())
+			return outside;
+		
+		Overlap result = inside;
+		for (int i=0; i<6; ++i) {
+			const GLfloat *p = planes[i];
+			// the corners farthest along the normal and against it
+			GLfloat farthest = p[3], nearest = p[3];
+			farthest += p[0]*(p[0] > 0.f ? box.upper.x : box.lower.x);
+			nearest += p[0]*(p[0] > 0.f ? box.lower.x : box.upper.x);
+			farthest += p[1]*(p[1] > 0.f ? box.upper.y : box.lower.y);
+			nearest += p[1]*(p[1] > 0.f ? box.lower.y : box.upper.y);
+			farthest += p[2]*(p[2] > 0.f ? box.upper.z : box.lower.z);
+			nearest += p[2]*(p[2] > 0.f ? box.lower.z : box.upper.z);
+			
+			if (farthest < 0.f)
+				return outside;
+			if (nearest < 0.f)
+				result = partly;
+		}
+		return result;
+	}
+	
+	GLfloat planes[6][4]; // a, b, c and d of ax + by + cz + d >= 0
+};
+
+// The first triangle a ray hits, see Model3DS::pick().
+struct RayHit
+{
+	RayHit(): object(noIndex), face(noIndex), distance(FLT_MAX), u(0.f), v(0.f) {}
+	
+	DWord object; // index into Model3DS::getObjects(), noIndex for none
+	DWord face; // index into the object's faces
+	GLfloat distance; // along the ray, in lengths of its direction
+	GLfloat u, v; // barycentric weights of the face's vertexB and vertexC
+};
+
+// laid out like the face records of the file
 struct Face
 {
 	Word vertexA, vertexB, vertexC;
+	Word flags; // edge visibility and texture wrapping bits
+};
+
+// Separate x, y and z arrays of the same vertices, a structure of arrays.
+struct VertexArrays
+{
+	VertexArrays(): x(NULL), y(NULL), z(NULL) {}
+	
+	GLfloat *x, *y, *z;
 };
 
 struct MapCoord
@@ -127,32 +380,62 @@ struct MapCoord
 	GLfloat u, v;
 };
 
+// A key of a position or scale track.
+struct VectorKey
+{
+	GLfloat frame;
+	Vector value;
+};
+
+// A key of a rotation track. The file stores each rotation relative to the
+// previous key, value is the absolute one.
+struct RotationKey
+{
+	GLfloat frame;
+	Quaternion value;
+};
+
+// The keys of a track are a range of one of the model's key arrays, in
+// increasing frame order.
+struct Track
+{
+	Track(): firstKey(0), numKeys(0), flags(0) {}
+	
+	static const DWord loop = 0x0002; // repeats after its last key
+	
+	DWord firstKey, numKeys;
+	DWord flags; // as in the file
+};
+
+// The transformation of an object at some frame, relative to its parent.
+struct Pose
+{
+	Pose(): scale(1.f, 1.f, 1.f) {}
+	
+	Vector position;
+	Quaternion rotation;
+	Vector scale;
+};
+
 struct Material
 {
-	Material(): name(NULL), texmapFile(NULL) {}
-	~Material()
-	{
-		delete [] name;
-		delete [] texmapFile;
-	}
+	Material(): name(NULL), texmapFile(NULL), nameId(noStringId) {}
 	
-	char *name, *texmapFile;
+	const char *name, *texmapFile; // owned by the model's StringTable
+	StringId nameId;
 	Color ambient, diffuse, specular;
 	GLuint textureRef;
 };
 
+// verticesRefs lives in the model's arena
 struct VertexList
 {
-	VertexList(): material(NULL), verticesRefs(NULL), numVerticesRefs(0) {}
-	~VertexList()
-	{
-		if (verticesRefs != NULL)
-			delete [] verticesRefs;
-	}
+	VertexList(): material(noIndex), verticesRefs(NULL), numVerticesRefs(0), indexOffset(0) {}
 	
-	Material *material;
+	DWord material; // index into Model3DS::getMaterials()
 	Word *verticesRefs;
 	DWord numVerticesRefs;
+	size_t indexOffset; // of verticesRefs in the model's index buffer, in bytes
 };
 
 #endif // _TYPES3DS_H_